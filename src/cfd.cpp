@@ -1,4 +1,11 @@
 #include "cfd.hpp"
+#include "readback.hpp"
+#include "probes.hpp"
+#include "statistics.hpp"
+#include "diagnostics.hpp"
+#include "fftProjection.hpp"
+
+#include <chrono>
 
 std::vector<float> init_velocities(size_t gridsize, float vx, float vy, float vz) {
     std::vector<float> velocities(gridsize * gridsize * gridsize * 3);
@@ -62,6 +69,19 @@ std::vector<float> init_wall(float base_val, int sizeX, int sizeY, int sizeZ) {
     return scalars;
 }
 
+std::vector<float> init_wall_y(float base_val, int sizeX, int sizeY, int sizeZ) {
+    std::vector<float> scalars(sizeX * sizeY * sizeZ);
+    for (int i = 0; i < scalars.size(); i += 1) {
+        int y = (i / sizeX) % sizeY;
+        if (y == 0 || y == sizeY-1) {
+            scalars[i] = base_val;
+        } else {
+            scalars[i] = 0.0;
+        }
+    }
+    return scalars;
+}
+
 std::vector<float> init_boundaries(int gridSize) {
     std::vector<float> scalars(gridSize * gridSize * gridSize);
     for (int i = 0; i < scalars.size(); i += 1) {
@@ -89,7 +109,56 @@ void add_boundary_cylinder(std::vector<float>& boundaries, int rad, int posX, in
     }
 }
 
-kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, std::vector<texture>& textures, PushConstants& pushConsts, size_t nThreads) {
+// Records kern's dispatch of nThreads x nMembers workgroups into its command
+// buffer. Can be called again to re-record with new push constants.
+void record_compute_kernel(kernel& kern, std::vector<texture>& textures, const void* pushData, uint32_t pushSize, size_t nThreads, size_t nMembers) {
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    vkBeginCommandBuffer(kern.cmdBuf, &beginInfo);
+    vkCmdBindPipeline(kern.cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kern.pipeline);
+    vkCmdBindDescriptorSets(kern.cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kern.pipelineLayout, 0, 1, &kern.descriptorSet, 0, nullptr);
+
+    // Transition image layouts
+    for (size_t i = 0; i < textures.size(); ++i) {
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = textures[i].image; // your VkImage
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(
+            kern.cmdBuf, // command buffer you're recording to
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier
+        );
+    }
+
+    vkCmdPushConstants(
+        kern.cmdBuf,
+        kern.pipelineLayout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        pushSize,
+        pushData
+    );
+
+    vkCmdDispatch(kern.cmdBuf, nThreads, nMembers, 1);
+    vkEndCommandBuffer(kern.cmdBuf);
+}
+
+kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, std::vector<texture>& textures, const void* pushData, uint32_t pushSize, size_t nThreads, size_t nMembers) {
     kernel kern;
     
     // Descriptor set bindings
@@ -115,7 +184,7 @@ kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule&
     VkPushConstantRange pushConstantRange = {};
     pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
     pushConstantRange.offset = 0;
-    pushConstantRange.size = sizeof(pushConsts);
+    pushConstantRange.size = pushSize;
 
     // Descriptor Set Layout
     VkDescriptorSetLayoutCreateInfo layoutInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
@@ -150,7 +219,7 @@ kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule&
     VkDescriptorPoolSize poolSizes[] = {{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, static_cast<uint32_t>(buffers.size())},
                                         {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, static_cast<uint32_t>(textures.size())}};
     VkDescriptorPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
-    poolInfo.poolSizeCount = sizeof(poolSizes) / sizeof(poolSizes[0]);
+    poolInfo.poolSizeCount = textures.empty() ? 1 : 2;
     poolInfo.pPoolSizes = poolSizes;
     poolInfo.maxSets = 1;
     // VkDescriptorPool descriptorPool;
@@ -187,57 +256,17 @@ kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule&
     // VkCommandBuffer cmdBuf;
     vkAllocateCommandBuffers(init.device.device, &cmdAllocInfo, &kern.cmdBuf);
 
-    // Begin command buffer
-    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    vkBeginCommandBuffer(kern.cmdBuf, &beginInfo);
-    vkCmdBindPipeline(kern.cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kern.pipeline);
-    vkCmdBindDescriptorSets(kern.cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kern.pipelineLayout, 0, 1, &kern.descriptorSet, 0, nullptr);
-
-    // Transition image layouts
-    for (size_t i = 0; i < textures.size(); ++i) {
-        VkImageMemoryBarrier barrier{};
-        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        barrier.image = textures[i].image; // your VkImage
-        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        barrier.subresourceRange.baseMipLevel = 0;
-        barrier.subresourceRange.levelCount = 1;
-        barrier.subresourceRange.baseArrayLayer = 0;
-        barrier.subresourceRange.layerCount = 1;
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-
-        vkCmdPipelineBarrier(
-            kern.cmdBuf, // command buffer you're recording to
-            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-            0,
-            0, nullptr,
-            0, nullptr,
-            1, &barrier
-        );
-    }
-
-    vkCmdPushConstants(
-        kern.cmdBuf,
-        kern.pipelineLayout,
-        VK_SHADER_STAGE_COMPUTE_BIT,
-        0,
-        sizeof(pushConsts),
-        &pushConsts
-    );
-
-    vkCmdDispatch(kern.cmdBuf, nThreads, 1, 1);
-    vkEndCommandBuffer(kern.cmdBuf);
+    record_compute_kernel(kern, textures, pushData, pushSize, nThreads, nMembers);
 
     return kern;
 }
 
 
-kernel gaussSiedelKernel(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, PushConstants& pushConsts, size_t nThreads) {
+kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, std::vector<texture>& textures, PushConstants& pushConsts, size_t nThreads, size_t nMembers) {
+    return build_compute_kernal(init, handler, shaderModule, buffers, textures, &pushConsts, sizeof(pushConsts), nThreads, nMembers);
+}
+
+kernel gaussSiedelKernel(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, PushConstants& pushConsts, size_t nThreads, size_t nMembers) {
     kernel kern;
     
     // Descriptor set bindings
@@ -339,7 +368,7 @@ kernel gaussSiedelKernel(Init& init, ComputeHandler& handler, VkShaderModule& sh
     vkCmdBindPipeline(kern.cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kern.pipeline);
     vkCmdBindDescriptorSets(kern.cmdBuf, VK_PIPELINE_BIND_POINT_COMPUTE, kern.pipelineLayout, 0, 1, &kern.descriptorSet, 0, nullptr);
 
-    vkCmdDispatch(kern.cmdBuf, nThreads, 1, 1);
+    vkCmdDispatch(kern.cmdBuf, nThreads, nMembers, 1);
 
     pushConsts. shouldRed = 0;
 
@@ -352,156 +381,426 @@ kernel gaussSiedelKernel(Init& init, ComputeHandler& handler, VkShaderModule& sh
         &pushConsts
     );
 
-    vkCmdDispatch(kern.cmdBuf, nThreads, 1, 1);
+    vkCmdDispatch(kern.cmdBuf, nThreads, nMembers, 1);
     vkEndCommandBuffer(kern.cmdBuf);
 
     return kern;
 }
 
+void initial_conditions(int gridSize, const Inflow& inflow, std::vector<float>& vxs, std::vector<float>& vys, std::vector<float>& vzs,
+    std::vector<float>& densities, std::vector<float>& boundariesVec) {
+    // Wall of flow in the inflow direction
+    float inflowX = inflow.speed * std::cos(inflow.direction);
+    float inflowY = inflow.speed * std::sin(inflow.direction);
+    vxs = init_wall(inflowX, gridSize+1, gridSize, gridSize);
+    vys = inflowY == 0.0f ? init_vels(gridSize, 0.0f) : init_wall_y(inflowY, gridSize, gridSize+1, gridSize);
+    vzs = init_vels(gridSize, 0.0f);
+    densities = init_scalars(gridSize, 0.0f);
+    boundariesVec = init_boundaries(gridSize+2);
+
+    // Arbitrary Geometry
+    // add_boundary_cylinder(boundariesVec, 10, 0, 0, gridSize+2);
+    // add_boundary_cylinder(boundariesVec, 10, -20, -20, gridSize+2);
+
+    int nStreams = 10;
+    int streamSize = gridSize / nStreams;
+    for (int i=0; i<nStreams; i++) {
+        densities[gridSize*gridSize*(gridSize/2) + gridSize*i*streamSize + 0] = 2.0f;
+    }
+
+    for (int i=0; i<gridSize+2; i++)
+    {
+        boundariesVec[(gridSize+2)*(gridSize+2)*(gridSize/2+1) + (gridSize+2)*(i) + (0+1)] = 0.0f;
+    }
+}
+
+void upload_inflows(Init& init, Cfd& cfd) {
+    std::vector<float> inflows(2 * cfd.members);
+    for (int m = 0; m < cfd.members; m++) {
+        inflows[2*m] = cfd.ensemble[m].speed * std::cos(cfd.ensemble[m].direction);
+        inflows[2*m + 1] = cfd.ensemble[m].speed * std::sin(cfd.ensemble[m].direction);
+    }
+    copy_to_buffer(init, cfd.inflows, inflows.data());
+}
+
+// Every member restarts at time 0 with the fixed timestep; with cfd.cfl set
+// the diagnostics reduction adapts it from the first step on
+void reset_solver_params(Init& init, Cfd& cfd) {
+    std::vector<SolverParams> params(cfd.members, SolverParams{solverDt, 0.0f, {0.0f, 0.0f}});
+    copy_to_buffer(init, cfd.params, params.data());
+}
+
 void init_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd, int gridSize) {
     cfd.gridSize = gridSize;
+    if (cfd.ensemble.empty()) cfd.ensemble.push_back(Inflow{});
+    cfd.members = cfd.ensemble.size();
+
+    if (cfd.backend == Backend::cpu) {
+        if (cfd.members > 1) {
+            std::cout << "CPU backend runs the first ensemble member only\n";
+            cfd.members = 1;
+        }
+        init_cpu_cfd(cfd.cpu, gridSize);
+
+        std::vector<float> vxs, vys, vzs, densities, boundariesVec;
+        initial_conditions(gridSize, cfd.ensemble[0], vxs, vys, vzs, densities, boundariesVec);
+        fill_cpu_field(cfd.cpu, cfd.cpu.vx, vxs);
+        fill_cpu_field(cfd.cpu, cfd.cpu.vy, vys);
+        fill_cpu_field(cfd.cpu, cfd.cpu.vz, vzs);
+        fill_cpu_field(cfd.cpu, cfd.cpu.density, densities);
+        fill_cpu_field(cfd.cpu, cfd.cpu.boundaries, boundariesVec);
+        update_cpu_masks(cfd.cpu);
+        return;
+    }
+
     const uint local_work_size = 32;
 
-    const int bufferSize = gridSize * gridSize * gridSize * sizeof(float);
-    const int velBufferSize = (gridSize+1) * gridSize * gridSize * sizeof(float);
-    const int boarderBufferSize = (gridSize+2) * (gridSize+2) * (gridSize+2) * sizeof(float);
+    // Per member; each dispatch runs nThreads x members workgroups
+    const uint64_t bufferSize = uint64_t(gridSize) * gridSize * gridSize * sizeof(float);
+    const uint64_t velBufferSize = uint64_t(gridSize+1) * gridSize * gridSize * sizeof(float);
+    const uint64_t boarderBufferSize = uint64_t(gridSize+2) * (gridSize+2) * (gridSize+2) * sizeof(float);
     const int nThreads = (gridSize * gridSize * gridSize + local_work_size - 1) / local_work_size;
     const int nThreadsVel = ((gridSize+1) * gridSize * gridSize + local_work_size - 1) / local_work_size;
+    const int members = cfd.members;
 
 
     cfd.boundaries = create_compute_buffer(init, boarderBufferSize);
 
-    cfd.vx = create_compute_buffer(init, velBufferSize);
-    cfd.vy = create_compute_buffer(init, velBufferSize);
-    cfd.vz = create_compute_buffer(init, velBufferSize);
+    cfd.vx = create_compute_buffer(init, velBufferSize * members);
+    cfd.vy = create_compute_buffer(init, velBufferSize * members);
+    cfd.vz = create_compute_buffer(init, velBufferSize * members);
+
+    cfd.vx2 = create_compute_buffer(init, velBufferSize * members);
+    cfd.vy2 = create_compute_buffer(init, velBufferSize * members);
+    cfd.vz2 = create_compute_buffer(init, velBufferSize * members);
 
-    cfd.vx2 = create_compute_buffer(init, velBufferSize);
-    cfd.vy2 = create_compute_buffer(init, velBufferSize);
-    cfd.vz2 = create_compute_buffer(init, velBufferSize);
+    cfd.density = create_compute_buffer(init, bufferSize * members);
+    cfd.pressure = create_compute_buffer(init, bufferSize * members);
 
-    cfd.density = create_compute_buffer(init, bufferSize);
-    cfd.pressure = create_compute_buffer(init, bufferSize);
+    cfd.density2 = create_compute_buffer(init, bufferSize * members);
+    cfd.pressure2 = create_compute_buffer(init, bufferSize * members);
 
-    cfd.density2 = create_compute_buffer(init, bufferSize);
-    cfd.pressure2 = create_compute_buffer(init, bufferSize);
+    cfd.temperature = create_compute_buffer(init, bufferSize * members);
+    cfd.temperature2 = create_compute_buffer(init, bufferSize * members);
 
+    cfd.inflows = create_compute_buffer(init, 2 * sizeof(float) * members);
+    cfd.params = create_compute_buffer(init, sizeof(SolverParams) * members);
 
-    cfd.densityTex.x = gridSize;
-    cfd.densityTex.y = gridSize;
-    cfd.densityTex.z = gridSize;
-    create3DTexture(init, cfd.densityTex);
-    std::vector<texture> textures = {cfd.densityTex};
+    cfd.apertureX = create_compute_buffer(init, boarderBufferSize);
+    cfd.apertureY = create_compute_buffer(init, boarderBufferSize);
+    cfd.apertureZ = create_compute_buffer(init, boarderBufferSize);
+    cfd.columnHeights = create_compute_buffer(init, uint64_t(gridSize) * gridSize * sizeof(float));
+
+
+    // The solver passes write no image; only kernDisplay does
+    std::vector<texture> textures;
 
 
     PushConstants pushConsts;
     pushConsts.gridSize = gridSize;
 
 
-    std::vector<buffer> buffersGaussSiedel = {cfd.vx, cfd.vy, cfd.vz, cfd.boundaries};
+    std::vector<buffer> buffersGaussSiedel = {cfd.vx, cfd.vy, cfd.vz, cfd.boundaries, cfd.apertureX, cfd.apertureY, cfd.apertureZ};
     VkShaderModule shaderGaussSiedel = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/gaussSiedel.spv"));
-    cfd.kernGaussSiedel = gaussSiedelKernel(init, computeHandler, shaderGaussSiedel, buffersGaussSiedel, pushConsts, nThreads);
+    cfd.kernGaussSiedel = gaussSiedelKernel(init, computeHandler, shaderGaussSiedel, buffersGaussSiedel, pushConsts, nThreads, members);
 
     VkShaderModule shaderModule = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/advect.spv"));
-    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.boundaries};
-    std::vector<buffer> buffers2 = {cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.boundaries};
-    cfd.kern = build_compute_kernal(init, computeHandler, shaderModule, buffers, textures, pushConsts, nThreadsVel);
-    cfd.kern2 = build_compute_kernal(init, computeHandler, shaderModule, buffers2, textures, pushConsts, nThreadsVel);
+    // MacCormack: kern and kern2 write the forward step into the hat buffers
+    // and kernCorrect and kernCorrect2 correct it into the usual destination.
+    // Otherwise the hat bindings alias the second buffers and go unread.
+    if (cfd.maccormack) {
+        cfd.vxHat = create_compute_buffer(init, velBufferSize * members);
+        cfd.vyHat = create_compute_buffer(init, velBufferSize * members);
+        cfd.vzHat = create_compute_buffer(init, velBufferSize * members);
+    }
+    buffer& hatX = cfd.maccormack ? cfd.vxHat : cfd.vx2;
+    buffer& hatY = cfd.maccormack ? cfd.vyHat : cfd.vy2;
+    buffer& hatZ = cfd.maccormack ? cfd.vzHat : cfd.vz2;
+    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.boundaries, cfd.columnHeights, cfd.params,
+        cfd.temperature, cfd.temperature2, hatX, hatY, hatZ};
+    std::vector<buffer> buffers2 = {cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.boundaries, cfd.columnHeights, cfd.params,
+        cfd.temperature2, cfd.temperature, hatX, hatY, hatZ};
+    AdvectPushConstants advectConsts{gridSize, cfd.fusedAdvection ? 1 : 0, cfd.buoyancy, cfd.surfaceHeatFlux, 0, 0};
+    if (cfd.maccormack) {
+        AdvectPushConstants correctConsts = advectConsts;
+        correctConsts.advectDensity = 0;
+        correctConsts.stage = 2;
+        cfd.kernCorrect = build_compute_kernal(init, computeHandler, shaderModule, buffers, textures, &correctConsts, sizeof(correctConsts), nThreadsVel, members);
+        cfd.kernCorrect2 = build_compute_kernal(init, computeHandler, shaderModule, buffers2, textures, &correctConsts, sizeof(correctConsts), nThreadsVel, members);
+
+        advectConsts.stage = 1;
+        buffers[5] = buffers2[5] = hatX;
+        buffers[6] = buffers2[6] = hatY;
+        buffers[7] = buffers2[7] = hatZ;
+    }
+    cfd.kern = build_compute_kernal(init, computeHandler, shaderModule, buffers, textures, &advectConsts, sizeof(advectConsts), nThreadsVel, members);
+    // kern2 ends each step's advection, so it also moves every member's time on
+    AdvectPushConstants advectConsts2 = advectConsts;
+    advectConsts2.advanceTime = 1;
+    cfd.kern2 = build_compute_kernal(init, computeHandler, shaderModule, buffers2, textures, &advectConsts2, sizeof(advectConsts2), nThreadsVel, members);
 
     VkShaderModule shaderModuleWrtieTex = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/writeTexture.spv"));
-    std::vector<buffer> buffersWriteTex = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.density2, cfd.pressure2, cfd.boundaries};
-    std::vector<buffer> buffersWriteTex2 = {cfd.vx, cfd.vy, cfd.vz, cfd.density2, cfd.pressure2, cfd.density, cfd.pressure, cfd.boundaries};
-    cfd.kernWriteTex = build_compute_kernal(init, computeHandler, shaderModuleWrtieTex, buffersWriteTex, textures, pushConsts, nThreads);
-    cfd.kernWriteTex2 = build_compute_kernal(init, computeHandler, shaderModuleWrtieTex, buffersWriteTex2, textures, pushConsts, nThreads);
-
-    // Wall of x flow
-    std::vector<float> vxs = init_wall(2.0f, gridSize+1, gridSize, gridSize);
-    std::vector<float> vys = init_vels(gridSize, 0.0f);
-    std::vector<float> vzs = init_vels(gridSize, 0.0f);
-    std::vector<float> densities = init_scalars(gridSize, 0.0f);
-    std::vector<float> boundariesVec = init_boundaries(gridSize+2);
-
-    // Arbitrary Geometry
-    // add_boundary_cylinder(boundariesVec, 10, 0, 0, gridSize+2);
-    // add_boundary_cylinder(boundariesVec, 10, -20, -20, gridSize+2);
-
-    int nStreams = 10;
-    int streamSize = gridSize / nStreams;
-    for (int i=0; i<nStreams; i++) {
-        densities[gridSize*gridSize*(gridSize/2) + gridSize*i*streamSize + 0] = 2.0f;
+    std::vector<buffer> buffersWriteTex = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.density2, cfd.pressure2, cfd.boundaries, cfd.params};
+    std::vector<buffer> buffersWriteTex2 = {cfd.vx, cfd.vy, cfd.vz, cfd.density2, cfd.pressure2, cfd.density, cfd.pressure, cfd.boundaries, cfd.params};
+    cfd.kernWriteTex = build_compute_kernal(init, computeHandler, shaderModuleWrtieTex, buffersWriteTex, textures, pushConsts, nThreads, members);
+    cfd.kernWriteTex2 = build_compute_kernal(init, computeHandler, shaderModuleWrtieTex, buffersWriteTex2, textures, pushConsts, nThreads, members);
+
+    VkFormatProperties formatProps;
+    vkGetPhysicalDeviceFormatProperties(init.device.physical_device, VK_FORMAT_R16_SFLOAT, &formatProps);
+    cfd.displayEnabled = (formatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0;
+    if (!cfd.displayEnabled) std::cout << "device can't store R16F images, the window shows no flow\n";
+
+    const int displaySize = (gridSize + cfd.displayScale - 1) / cfd.displayScale;
+    cfd.displayTex.x = displaySize;
+    cfd.displayTex.y = displaySize;
+    cfd.displayTex.z = displaySize;
+    cfd.displayTex.format = VK_FORMAT_R16_SFLOAT;
+    create3DTexture(init, cfd.displayTex);
+    VkShaderModule shaderDisplay = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/display.spv"));
+    std::vector<buffer> buffersDisplay = {cfd.boundaries};
+    std::vector<texture> displayTextures = {cfd.displayTex};
+    DisplayPushConstants displayConsts{gridSize, cfd.displayScale};
+    const int nThreadsDisplay = (displaySize * displaySize * displaySize + local_work_size - 1) / local_work_size;
+    cfd.kernDisplay = build_compute_kernal(init, computeHandler, shaderDisplay, buffersDisplay, displayTextures,
+        &displayConsts, sizeof(displayConsts), nThreadsDisplay, 1);
+
+    VkShaderModule shaderReset = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/reset.spv"));
+    std::vector<buffer> buffersReset = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.inflows,
+        cfd.temperature, cfd.temperature2};
+    cfd.kernReset = build_compute_kernal(init, computeHandler, shaderReset, buffersReset, textures, pushConsts, nThreadsVel, members);
+
+    for (int m = 0; m < members; m++) {
+        std::vector<float> vxs, vys, vzs, densities, boundariesVec;
+        initial_conditions(gridSize, cfd.ensemble[m], vxs, vys, vzs, densities, boundariesVec);
+
+        copy_to_buffer(init, cfd.vx, vxs.data(), m * velBufferSize, velBufferSize);
+        copy_to_buffer(init, cfd.vy, vys.data(), m * velBufferSize, velBufferSize);
+        copy_to_buffer(init, cfd.vz, vzs.data(), m * velBufferSize, velBufferSize);
+        copy_to_buffer(init, cfd.density, densities.data(), m * bufferSize, bufferSize);
+        if (m == 0) copy_to_buffer(init, cfd.boundaries, boundariesVec.data());
     }
 
-    for (int i=0; i<gridSize+2; i++)
-    {
-        boundariesVec[(gridSize+2)*(gridSize+2)*(gridSize/2+1) + (gridSize+2)*(i) + (0+1)] = 0.0f;
-    }
+    // No cut cells until a terrain is voxelised with them
+    std::vector<float> apertures((gridSize+2) * (gridSize+2) * (gridSize+2), 1.0f);
+    std::vector<float> columnHeights(gridSize * gridSize, -1.0e30f);
+    copy_to_buffer(init, cfd.apertureX, apertures.data());
+    copy_to_buffer(init, cfd.apertureY, apertures.data());
+    copy_to_buffer(init, cfd.apertureZ, apertures.data());
+    copy_to_buffer(init, cfd.columnHeights, columnHeights.data());
+    reset_solver_params(init, cfd);
 
-    copy_to_buffer(init, cfd.vx, vxs.data());
-    copy_to_buffer(init, cfd.vy, vys.data());
-    copy_to_buffer(init, cfd.vz, vzs.data());
-    copy_to_buffer(init, cfd.density, densities.data());
-    copy_to_buffer(init, cfd.boundaries, boundariesVec.data());
+    // Both temperature buffers start at ambient; kernReset clears them after that
+    std::vector<float> temperatures(cfd.temperature.size / sizeof(float), 0.0f);
+    copy_to_buffer(init, cfd.temperature, temperatures.data());
+    copy_to_buffer(init, cfd.temperature2, temperatures.data());
 
     init.disp.destroyShaderModule(shaderGaussSiedel, nullptr);
     init.disp.destroyShaderModule(shaderModule, nullptr);
     init.disp.destroyShaderModule(shaderModuleWrtieTex, nullptr);
+    init.disp.destroyShaderModule(shaderReset, nullptr);
+    init.disp.destroyShaderModule(shaderDisplay, nullptr);
 }
 
-void loadTerrain(const std::string& filename, std::vector<float>& terrain, int& sizeX, int& sizeY) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Error opening file: " << filename << std::endl;
-        return;
-    }
+// Window of cfd.terrainWindow in samples of the loaded heightmap (cols x rows),
+// which covers cfd.terrainRegion of the source
+VoxelisePushConstants terrain_push_constants(const Cfd& cfd, uint32_t cols, uint32_t rows) {
+    const TerrainWindow& window = cfd.terrainWindow;
+    const PyramidRegion& region = cfd.terrainRegion;
+    float extentX = window.extentX > 0.0f ? window.extentX : region.sourceCols - window.offsetX;
+    float extentY = window.extentY > 0.0f ? window.extentY : region.sourceRows - window.offsetY;
+
+    VoxelisePushConstants pushConsts;
+    pushConsts.gridSize = cfd.gridSize;
+    pushConsts.terrainCols = cols;
+    pushConsts.terrainRows = rows;
+    pushConsts.computeFractions = cfd.solidFractions ? 1 : 0;
+    pushConsts.cutCells = cfd.cutCells ? 1 : 0;
+    pushConsts.offsetX = (window.offsetX - region.originX) / region.scale;
+    pushConsts.offsetY = (window.offsetY - region.originY) / region.scale;
+    pushConsts.stepX = extentX / region.scale / float(cfd.gridSize);
+    pushConsts.stepY = extentY / region.scale / float(cfd.gridSize);
+    pushConsts.heightScale = window.heightScale;
+    return pushConsts;
+}
 
-    sizeX = 0;
-    terrain.clear();
+// Whether the level 0 samples under the window are all in the loaded region
+bool window_loaded(const Cfd& cfd) {
+    const TerrainWindow& window = cfd.terrainWindow;
+    const PyramidRegion& region = cfd.terrainRegion;
+    float x0 = std::max(0.0f, window.offsetX);
+    float y0 = std::max(0.0f, window.offsetY);
+    float x1 = std::min<float>(region.sourceCols, window.extentX > 0.0f ? window.offsetX + window.extentX : region.sourceCols);
+    float y1 = std::min<float>(region.sourceRows, window.extentY > 0.0f ? window.offsetY + window.extentY : region.sourceRows);
+    return region.originX <= x0 && region.originY <= y0 &&
+           region.originX + cfd.terrainCols * region.scale >= x1 &&
+           region.originY + cfd.terrainRows * region.scale >= y1;
+}
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        float value;
-        sizeY = 0;
+void run_voxelise(Init& init, ComputeHandler& computeHandler, Cfd& cfd) {
+    auto start = std::chrono::steady_clock::now();
+    const uint local_work_size = 32;
+    const int boundarySize = cfd.gridSize + 2;
+    const int nThreads = (boundarySize * boundarySize * boundarySize + local_work_size - 1) / local_work_size;
+    VoxelisePushConstants pushConsts = terrain_push_constants(cfd, cfd.terrainCols, cfd.terrainRows);
+    std::vector<texture> textures;
+    record_compute_kernel(cfd.kernVoxelise, textures, &pushConsts, sizeof(pushConsts), nThreads, 1);
+    execute_kernel(init, computeHandler, cfd.kernVoxelise);
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Voxelised terrain in " << ms << " ms" << std::endl;
+}
 
-        while (iss >> value) {
-            terrain.push_back(value);
-            sizeY += 1;
-        }
-        sizeX += 1;
+void voxelise_terrain(Init& init, ComputeHandler& computeHandler, Cfd& cfd) {
+    if (cfd.backend == Backend::cpu || cfd.terrainFile.empty()) return;
+    // No heightmap on the device after a mask cache hit
+    if (cfd.terrainCols == 0 || !window_loaded(cfd)) {
+        std::cout << "Terrain window outside the loaded region, reading " << cfd.terrainFile << " again" << std::endl;
+        load_terrain(init, computeHandler, cfd, cfd.terrainFile);
+        return;
     }
-    file.close();
+    run_voxelise(init, computeHandler, cfd);
 }
 
-void load_terrain(Init& init, Cfd& cfd, const std::string& filename) {
-    int terrainSizeX, terrainSizeY;
-    std::vector<float> terrain;
-    loadTerrain(filename, terrain, terrainSizeX, terrainSizeY);
+void release_terrain(Init& init, Cfd& cfd) {
+    if (cfd.terrainCols == 0) return;
+    cleanup(init, cfd.kernVoxelise);
+    std::vector<buffer> buffers = {cfd.terrain, cfd.solidFraction};
+    cleanup(init, buffers);
+    cfd.terrainCols = 0;
+    cfd.terrainRows = 0;
+}
 
-    std::cout << "Terrain size: " << terrainSizeX << " x " << terrainSizeY << std::endl;
+// Everything the staircase mask depends on: the terrain file and how it is mapped
+int mask_cache_key(const Cfd& cfd, const std::string& filename, MaskCacheKey& key) {
+    if (0 != mask_cache_file_key(filename, key)) return -1;
+    const TerrainWindow& window = cfd.terrainWindow;
+    key.gridSize = cfd.gridSize;
+    key.window[0] = window.offsetX;
+    key.window[1] = window.offsetY;
+    key.window[2] = window.extentX;
+    key.window[3] = window.extentY;
+    key.window[4] = window.heightScale;
+    return 0;
+}
 
+void load_terrain(Init& init, ComputeHandler& computeHandler, Cfd& cfd, const std::string& filename) {
     int gridSize = cfd.gridSize;
     int boundarySize = gridSize + 2;
-    std::vector<float> boundariesVec = init_boundaries(boundarySize);
-    
-    float terrainStepX = terrainSizeX / float(gridSize);
-    float terrainStepY = terrainSizeY / float(gridSize);
+    cfd.terrainFile = filename;
+
+    // Cut cells and solid fractions aren't cached, only the mask
+    MaskCacheKey cacheKey;
+    bool useCache = !cfd.maskCacheDir.empty() && !cfd.cutCells && !cfd.solidFractions &&
+                    0 == mask_cache_key(cfd, filename, cacheKey);
+    if (useCache) {
+        std::vector<float> boundariesVec;
+        if (0 == read_mask_cache(cfd.maskCacheDir, cacheKey, size_t(boundarySize) * boundarySize * boundarySize, boundariesVec)) {
+            std::cout << "Boundary mask from cache" << std::endl;
+            if (cfd.backend == Backend::cpu) {
+                fill_cpu_field(cfd.cpu, cfd.cpu.boundaries, boundariesVec);
+                update_cpu_masks(cfd.cpu);
+                return;
+            }
+            release_terrain(init, cfd);
+            copy_to_buffer(init, cfd.boundaries, boundariesVec.data());
+            return;
+        }
+    }
 
-    std::cout << "Terrain step: " << terrainStepX << " x " << terrainStepY << std::endl;
+    HeightMap terrain;
+    const bool pyramid = is_height_pyramid(filename);
+    if (pyramid) {
+        // Only the tiles of the level matching the grid, over the window
+        const TerrainWindow& window = cfd.terrainWindow;
+        if (0 != read_pyramid_window(filename, PyramidChannel::mean, window.offsetX, window.offsetY,
+            window.extentX, window.extentY, cfd.gridSize, cfd.gridSize, terrain, cfd.terrainRegion)) return;
+        std::cout << "Terrain pyramid level " << cfd.terrainRegion.level << ", read "
+                  << cfd.terrainRegion.bytesRead / 1.0e6 << " MB" << std::endl;
+    } else {
+        if (0 != load_height_map(filename, terrain)) return;
+        cfd.terrainRegion = PyramidRegion();
+        cfd.terrainRegion.sourceCols = terrain.header.cols;
+        cfd.terrainRegion.sourceRows = terrain.header.rows;
+    }
+    const uint32_t cols = terrain.header.cols, rows = terrain.header.rows;
+    if (cols == 0 || rows == 0) return;
+
+    std::cout << "Terrain size: " << cols << " x " << rows << std::endl;
+
+    if (cfd.backend == Backend::gpu) {
+        // Only the samples under the window, plus one around them for the
+        // bilinear cut cells; a pyramid read is already cut to the window
+        uint32_t col0 = 0, row0 = 0, col1 = cols, row1 = rows;
+        if (!pyramid) {
+            const TerrainWindow& window = cfd.terrainWindow;
+            float endX = window.extentX > 0.0f ? window.offsetX + window.extentX : float(cols);
+            float endY = window.extentY > 0.0f ? window.offsetY + window.extentY : float(rows);
+            col0 = std::min<float>(std::max(0.0f, std::floor(window.offsetX) - 1.0f), cols - 1);
+            row0 = std::min<float>(std::max(0.0f, std::floor(window.offsetY) - 1.0f), rows - 1);
+            col1 = std::min<float>(std::max<float>(col0 + 1, std::ceil(endX) + 1.0f), cols);
+            row1 = std::min<float>(std::max<float>(row0 + 1, std::ceil(endY) + 1.0f), rows);
+            cfd.terrainRegion.originX = col0;
+            cfd.terrainRegion.originY = row0;
+        }
 
-    for (int i = 0; i < boundariesVec.size(); i += 1) {
-        int x = i % boundarySize;
-        int y = (i / boundarySize) % boundarySize;
-        int z = i / (boundarySize * boundarySize);
+        // As f32 with no-data read as 0, so the kernel needs no dtype
+        const uint32_t regionCols = col1 - col0, regionRows = row1 - row0;
+        std::vector<float> heights(size_t(regionCols) * regionRows);
+        for (uint32_t row = 0; row < regionRows; row++) {
+            for (uint32_t col = 0; col < regionCols; col++) {
+                heights[col + size_t(row) * regionCols] = height_at(terrain, col0 + col, row0 + row);
+            }
+        }
+        close_height_map(terrain);
+        if (regionCols != cols || regionRows != rows) {
+            std::cout << "Uploading " << regionCols << " x " << regionRows << " samples under the window" << std::endl;
+        }
 
-        if (x > 0 && x < gridSize+1 && y > 0 && y < gridSize+1) {
-            int terrainX = (x-1) * terrainStepX;
-            int terrainY = (y-1) * terrainStepY;
-    
-            float terrainHeight = terrain[terrainX + terrainY*terrainSizeX];
+        release_terrain(init, cfd);
+        cfd.terrainCols = regionCols;
+        cfd.terrainRows = regionRows;
+        cfd.terrain = create_compute_buffer(init, heights.size() * sizeof(float));
+        cfd.solidFraction = create_compute_buffer(init, uint64_t(boundarySize) * boundarySize * boundarySize * sizeof(float));
+        copy_to_buffer(init, cfd.terrain, heights.data());
+
+        VoxelisePushConstants pushConsts = terrain_push_constants(cfd, cfd.terrainCols, cfd.terrainRows);
+        std::vector<buffer> buffers = {cfd.terrain, cfd.boundaries, cfd.solidFraction, cfd.apertureX, cfd.apertureY, cfd.apertureZ, cfd.columnHeights};
+        std::vector<texture> textures;
+        VkShaderModule shaderVoxelise = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/voxelise.spv"));
+        cfd.kernVoxelise = build_compute_kernal(init, computeHandler, shaderVoxelise, buffers, textures, &pushConsts, sizeof(pushConsts), 1, 1);
+        init.disp.destroyShaderModule(shaderVoxelise, nullptr);
+
+        run_voxelise(init, computeHandler, cfd);
+        if (useCache) {
+            std::vector<float> boundariesVec(size_t(boundarySize) * boundarySize * boundarySize);
+            copy_from_buffer(init, cfd.boundaries, boundariesVec.data());
+            write_mask_cache(cfd.maskCacheDir, cacheKey, boundariesVec);
+        }
+        return;
+    }
+
+    if (cfd.cutCells) std::cout << "CPU backend has no cut cells, using the staircase terrain\n";
+    VoxelisePushConstants window = terrain_push_constants(cfd, cols, rows);
 
-            if (z >= terrainHeight*boundarySize) {
-                boundariesVec[i] = 1.0;
-            } else {
-                boundariesVec[i] = 0.0;
+    std::cout << "Terrain step: " << window.stepX << " x " << window.stepY << std::endl;
+
+    // Sample each column once, straight from the mapping
+    std::vector<float> heights(gridSize * gridSize);
+    for (int y = 0; y < gridSize; y++) {
+        for (int x = 0; x < gridSize; x++) {
+            size_t col = std::min<size_t>(std::max(0.0f, x * window.stepX + window.offsetX), cols - 1);
+            size_t row = std::min<size_t>(std::max(0.0f, y * window.stepY + window.offsetY), rows - 1);
+            heights[x + y * gridSize] = height_at(terrain, col, row) * window.heightScale;
+        }
+    }
+    close_height_map(terrain);
+
+    std::vector<float> boundariesVec = init_boundaries(boundarySize);
+    for (int z = 0; z < boundarySize; z++) {
+        for (int y = 1; y < gridSize+1; y++) {
+            for (int x = 1; x < gridSize+1; x++) {
+                float terrainHeight = heights[(x-1) + (y-1) * gridSize];
+                boundariesVec[x + y * boundarySize + z * boundarySize * boundarySize] = z >= terrainHeight*boundarySize ? 1.0f : 0.0f;
             }
         }
     }
@@ -511,31 +810,163 @@ void load_terrain(Init& init, Cfd& cfd, const std::string& filename) {
         boundariesVec[(gridSize+2)*(gridSize+2)*(gridSize/2+1) + (gridSize+2)*(i) + (0+1)] = 0.0f;
     }
 
-    copy_to_buffer(init, cfd.boundaries, boundariesVec.data());
+    if (useCache) write_mask_cache(cfd.maskCacheDir, cacheKey, boundariesVec);
+    fill_cpu_field(cfd.cpu, cfd.cpu.boundaries, boundariesVec);
+    update_cpu_masks(cfd.cpu);
+}
+
+void read_member(Init& init, Cfd& cfd, buffer& buf, int member, std::vector<float>& values) {
+    uint64_t stride = buf.size / cfd.members;
+    values.resize(stride / sizeof(float));
+    copy_from_buffer(init, buf, values.data(), member * stride, stride);
+}
+
+void read_member_fields(Init& init, Cfd& cfd, int member, std::vector<float>& vx, std::vector<float>& vy,
+    std::vector<float>& vz, std::vector<float>& density) {
+    if (cfd.backend == Backend::cpu) {
+        vx.assign(cfd.cpu.vx.begin(), cfd.cpu.vx.end());
+        vy.assign(cfd.cpu.vy.begin(), cfd.cpu.vy.end());
+        vz.assign(cfd.cpu.vz.begin(), cfd.cpu.vz.end());
+        density.assign(cfd.cpu.density.begin(), cfd.cpu.density.end());
+        return;
+    }
+
+    read_member(init, cfd, cfd.vx, member, vx);
+    read_member(init, cfd, cfd.vy, member, vy);
+    read_member(init, cfd, cfd.vz, member, vz);
+    read_member(init, cfd, cfd.density, member, density);
+}
+
+void reset_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd) {
+    cfd.step = 0;
+    if (cfd.backend == Backend::cpu) {
+        std::vector<float> vxs, vys, vzs, densities, boundariesVec;
+        initial_conditions(cfd.gridSize, cfd.ensemble[0], vxs, vys, vzs, densities, boundariesVec);
+        fill_cpu_field(cfd.cpu, cfd.cpu.vx, vxs);
+        fill_cpu_field(cfd.cpu, cfd.cpu.vy, vys);
+        fill_cpu_field(cfd.cpu, cfd.cpu.vz, vzs);
+        fill_cpu_field(cfd.cpu, cfd.cpu.density, densities);
+        return;
+    }
+
+    upload_inflows(init, cfd);
+    reset_solver_params(init, cfd);
+    execute_kernel(init, computeHandler, cfd.kernReset);
 }
 
 void evolve_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd) {
-    for (int i=0; i<10; i++)
-    {
-        execute_kernel(init, computeHandler, cfd.kernGaussSiedel);
+    cfd.step++;
+    if (cfd.backend == Backend::cpu) {
+        evolve_cpu_cfd(cfd.cpu);
+        return;
+    }
+
+    if (cfd.fftProjection != nullptr) {
+        run_fft_projection(init, computeHandler, cfd, *cfd.fftProjection);
+    } else {
+        for (int i=0; i<10; i++)
+        {
+            execute_kernel(init, computeHandler, cfd.kernGaussSiedel);
+        }
     }
 
+    // Fused, each pass advects density along the velocity it advects; unfused,
+    // both density passes follow the velocity after both velocity passes
     execute_kernel(init, computeHandler, cfd.kern);
+    if (cfd.maccormack) execute_kernel(init, computeHandler, cfd.kernCorrect);
     execute_kernel(init, computeHandler, cfd.kern2);
+    if (cfd.maccormack) execute_kernel(init, computeHandler, cfd.kernCorrect2);
 
-    execute_kernel(init, computeHandler, cfd.kernWriteTex);
-    execute_kernel(init, computeHandler, cfd.kernWriteTex2);
+    if (!cfd.fusedAdvection) {
+        execute_kernel(init, computeHandler, cfd.kernWriteTex);
+        execute_kernel(init, computeHandler, cfd.kernWriteTex2);
+    }
+
+    if (cfd.probes != nullptr) sample_probes(init, computeHandler, cfd, *cfd.probes);
+    if (cfd.statistics != nullptr) accumulate_statistics(init, computeHandler, cfd, *cfd.statistics);
+    if (cfd.diagnostics != nullptr) run_diagnostics(init, computeHandler, *cfd.diagnostics);
+    if (cfd.readback != nullptr) readback_step(init, computeHandler, *cfd.readback);
+}
+
+void update_display(Init& init, ComputeHandler& computeHandler, Cfd& cfd) {
+    if (cfd.backend == Backend::cpu || !cfd.displayEnabled) return;
+    execute_kernel(init, computeHandler, cfd.kernDisplay);
+}
+
+float max_difference(const std::vector<float>& a, const CpuField& b) {
+    float diff = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        diff = std::max(diff, std::abs(a[i] - b[i]));
+    }
+    return diff;
+}
+
+float validate_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd) {
+    CpuCfd ref;
+    init_cpu_cfd(ref, cfd.gridSize);
+
+    // Compares the first ensemble member
+    if (cfd.cutCells) std::cout << "CPU reference has no cut cells, expect differences near the terrain\n";
+    if (cfd.fusedAdvection) std::cout << "CPU reference advects density after velocity, run with --unfused to match it\n";
+    if (cfd.maccormack) std::cout << "CPU reference advects semi-Lagrangian, expect differences with --maccormack\n";
+    if (cfd.fftProjection != nullptr) std::cout << "CPU reference projects with Gauss-Seidel, expect differences with --fft-projection\n";
+    std::vector<float> vx, vy, vz, density, density2;
+    copy_from_buffer(init, cfd.boundaries, ref.boundaries.data());
+    read_member(init, cfd, cfd.vx, 0, vx);
+    read_member(init, cfd, cfd.vy, 0, vy);
+    read_member(init, cfd, cfd.vz, 0, vz);
+    read_member(init, cfd, cfd.density, 0, density);
+    read_member(init, cfd, cfd.density2, 0, density2);
+    std::copy(vx.begin(), vx.end(), ref.vx.begin());
+    std::copy(vy.begin(), vy.end(), ref.vy.begin());
+    std::copy(vz.begin(), vz.end(), ref.vz.begin());
+    std::copy(density.begin(), density.end(), ref.density.begin());
+    std::copy(density2.begin(), density2.end(), ref.density2.begin());
+    update_cpu_masks(ref);
+
+    evolve_cfd(init, computeHandler, cfd);
+    evolve_cpu_cfd(ref);
+
+    read_member(init, cfd, cfd.vx, 0, vx);
+    read_member(init, cfd, cfd.vy, 0, vy);
+    read_member(init, cfd, cfd.vz, 0, vz);
+    read_member(init, cfd, cfd.density, 0, density);
+
+    float diffVx = max_difference(vx, ref.vx);
+    float diffVy = max_difference(vy, ref.vy);
+    float diffVz = max_difference(vz, ref.vz);
+    float diffDensity = max_difference(density, ref.density);
+    std::cout << "GPU vs CPU (" << cpu_simd_name() << ") max difference: vx " << diffVx << ", vy " << diffVy
+              << ", vz " << diffVz << ", density " << diffDensity << std::endl;
+
+    cleanup(ref);
+    return std::max(std::max(diffVx, diffVy), std::max(diffVz, diffDensity));
 }
 
 void cleanup(Init &init, Cfd &cfd)
 {
+    if (cfd.backend == Backend::cpu) {
+        cleanup(cfd.cpu);
+        return;
+    }
+
     cleanup(init, cfd.kernGaussSiedel);
     cleanup(init, cfd.kern);
     cleanup(init, cfd.kern2);
     cleanup(init, cfd.kernWriteTex);
     cleanup(init, cfd.kernWriteTex2);
+    cleanup(init, cfd.kernReset);
+    cleanup(init, cfd.kernDisplay);
+    if (cfd.maccormack) {
+        cleanup(init, cfd.kernCorrect);
+        cleanup(init, cfd.kernCorrect2);
+        std::vector<buffer> hats = {cfd.vxHat, cfd.vyHat, cfd.vzHat};
+        cleanup(init, hats);
+    }
+    release_terrain(init, cfd);
 
-    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.boundaries};
+    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.pressure, cfd.vx2, cfd.vy2, cfd.vz2, cfd.density2, cfd.pressure2, cfd.boundaries, cfd.inflows, cfd.params,
+        cfd.temperature, cfd.temperature2, cfd.apertureX, cfd.apertureY, cfd.apertureZ, cfd.columnHeights};
     cleanup(init, buffers);
-    cleanup(init, cfd.densityTex);   
+    cleanup(init, cfd.displayTex);
 }
@@ -1,15 +1,68 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <sstream>
 
 #include "vkHelper.hpp"
 #include "shaderHelper.hpp"
+#include "cpuSolver.hpp"
+#include "terrainPyramid.hpp"
+#include "maskCache.hpp"
 
+enum class Backend {
+    gpu,
+    cpu
+};
+
+// Inflow of one ensemble member: speed and horizontal direction in radians from +x
+struct Inflow {
+    float speed = 2.0f;
+    float direction = 0.0f;
+};
+
+// Part of the heightmap mapped onto the grid, in heightmap samples. An extent
+// of 0 covers the rest of the map. Heights are fractions of the domain height.
+struct TerrainWindow {
+    float offsetX = 0.0f;
+    float offsetY = 0.0f;
+    float extentX = 0.0f;
+    float extentY = 0.0f;
+    float heightScale = 1.0f;
+};
+
+struct Readback;
+struct Probes;
+struct Statistics;
+struct Diagnostics;
+struct FftProjection;
+
+// Time step of the solver kernels, and the bounds on the adaptive one
+const float solverDt = 0.1f;
+const float minSolverDt = 1e-4f;
+const float maxSolverDt = 1.0f;
+
+// Per member in Cfd::params; dt is read by the kernels, written by diagnostics.
+// kern2 adds dt to time every step, with or without diagnostics.
+struct SolverParams {
+    float dt;
+    float time;
+    float reserved[2];
+};
+
+// The GPU backend runs every member of ensemble in lock step. Each velocity and
+// density buffer holds the members back to back, boundaries is shared by all.
 struct Cfd {
+    Backend backend = Backend::gpu;
     int gridSize;
 
+    std::vector<Inflow> ensemble;
+    int members = 1;
+    // Steps taken by evolve_cfd, carried over by checkpoints
+    long step = 0;
+
     buffer boundaries;
 
     buffer vx;
@@ -26,13 +79,89 @@ struct Cfd {
     buffer density2;
     buffer pressure2;
 
-    texture densityTex;
+    // Temperature above ambient, advected with density by the fused pass
+    buffer temperature;
+    buffer temperature2;
+
+    // Inflow (x, y) velocity per member, read by kernReset
+    buffer inflows;
+    // SolverParams per member
+    buffer params;
+    // Target CFL number of the adaptive timestep; 0 keeps solverDt
+    float cfl = 0.0f;
+    // kern and kern2 also advect density, replacing kernWriteTex and
+    // kernWriteTex2. Read by init_cfd.
+    bool fusedAdvection = true;
+    // Boussinesq buoyancy, g times the thermal expansion coefficient, and the
+    // temperature per unit time gained by fluid cells resting on terrain.
+    // Need the fused pass; read by init_cfd.
+    float buoyancy = 0.0f;
+    float surfaceHeatFlux = 0.0f;
+    // Second-order MacCormack velocity advection, limited to the stencil of
+    // the backtrace; needs the hat buffers and kernCorrect. Read by init_cfd.
+    bool maccormack = false;
+    buffer vxHat;
+    buffer vyHat;
+    buffer vzHat;
+
+    // Open share of the low x, y and z face of each boundary cell, and the
+    // terrain surface per column; written by kernVoxelise
+    buffer apertureX;
+    buffer apertureY;
+    buffer apertureZ;
+    buffer columnHeights;
+
+    // Single-channel view of member 0 for the window, written by kernDisplay
+    // once per presented frame rather than by the solver passes every step.
+    // Each texel covers displayScale^3 cells.
+    texture displayTex;
+    int displayScale = 1;
+    // Device can store R16F images; without it there is no display pass
+    bool displayEnabled = false;
 
     kernel kernGaussSiedel;
     kernel kern;
     kernel kern2;
     kernel kernWriteTex;
     kernel kernWriteTex2;
+    kernel kernReset;
+    kernel kernDisplay;
+    kernel kernCorrect;
+    kernel kernCorrect2;
+
+    // Heightmap kept on the device by load_terrain so kernVoxelise can
+    // rebuild the boundaries for a new window without touching the file
+    TerrainWindow terrainWindow;
+    // File read by load_terrain, read again when the window leaves the region
+    std::string terrainFile;
+    // Part of the source the heightmap on the device covers: the samples under
+    // the window, from the pyramid level matching the grid for pyramids
+    PyramidRegion terrainRegion;
+    bool solidFractions = false;
+    // Cut cells: partly solid cells stay fluid, with face apertures weighting the
+    // pressure solve and column heights clamping advection. GPU backend only.
+    bool cutCells = false;
+    // Directory of the boundary mask cache; empty to always voxelise
+    std::string maskCacheDir;
+    uint32_t terrainCols = 0;
+    uint32_t terrainRows = 0;
+    buffer terrain;
+    // Share of each boundary cell below the terrain, when solidFractions is set
+    buffer solidFraction;
+    kernel kernVoxelise;
+
+    // Set by start_readback; evolve_cfd queues its copies after every step
+    Readback* readback = nullptr;
+    // Set by start_probes; evolve_cfd samples them after every step
+    Probes* probes = nullptr;
+    // Set by start_statistics; evolve_cfd accumulates every step into it
+    Statistics* statistics = nullptr;
+    // Set by start_diagnostics; evolve_cfd reduces every step with it
+    Diagnostics* diagnostics = nullptr;
+    // Set by start_fft_projection; replaces the Gauss-Seidel iterations
+    FftProjection* fftProjection = nullptr;
+
+    CpuCfd cpu;
 };
 
 struct PushConstants {
@@ -40,12 +169,78 @@ struct PushConstants {
     int shouldRed;
 };
 
+struct AdvectPushConstants {
+    int gridSize;
+    int advectDensity;
+    float buoyancy;
+    float surfaceHeatFlux;
+    int stage;
+    int advanceTime;
+};
+
+struct DisplayPushConstants {
+    int gridSize;
+    int scale;
+};
+
+struct VoxelisePushConstants {
+    int gridSize;
+    int terrainCols;
+    int terrainRows;
+    int computeFractions;
+    int cutCells;
+    float offsetX;
+    float offsetY;
+    float stepX;
+    float stepY;
+    float heightScale;
+};
+
 int create_command_buffers(Init& init, RenderData& data, std::vector<texture>& textures);
 
+// Compute kernel over buffers then textures, dispatching nThreads x nMembers
+// workgroups with pushData as its push constants
+kernel build_compute_kernal(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, std::vector<texture>& textures, const void* pushData, uint32_t pushSize, size_t nThreads, size_t nMembers);
+
+// Re-records kern's dispatch, e.g. with new push constants
+void record_compute_kernel(kernel& kern, std::vector<texture>& textures, const void* pushData, uint32_t pushSize, size_t nThreads, size_t nMembers);
+
 void init_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd, int gridSize);
 
-void load_terrain(Init& init, Cfd& cfd, const std::string& filename);
+// Builds the boundaries from a heightmap or pyramid through cfd.terrainWindow. On the GPU
+// the samples under the window are uploaded once and voxelised by kernVoxelise. With
+// cfd.maskCacheDir set, a mask already built for the same file and window is
+// loaded from the cache instead, and no heightmap is kept.
+void load_terrain(Init& init, ComputeHandler& computeHandler, Cfd& cfd, const std::string& filename);
+
+// Rebuilds the boundaries (and solid fractions) from the loaded heightmap,
+// e.g. after changing cfd.terrainWindow. A window reaching outside the loaded
+// region reads the terrain file again. GPU backend only.
+void voxelise_terrain(Init& init, ComputeHandler& computeHandler, Cfd& cfd);
+
+// Copies one ensemble member of a velocity (or density) buffer into values
+void read_member(Init& init, Cfd& cfd, buffer& buf, int member, std::vector<float>& values);
+
+// Velocities and density of one member, from either backend
+void read_member_fields(Init& init, Cfd& cfd, int member, std::vector<float>& vx, std::vector<float>& vy,
+    std::vector<float>& vz, std::vector<float>& density);
+
+// Puts every member back to the initial conditions for its entry of ensemble,
+// keeping the boundaries. On the GPU this runs kernReset, with no uploads
+// besides the inflow velocities, the timesteps and the ambient temperature.
+void reset_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd);
+
+// Copies each member's inflow speed and direction from cfd.ensemble into
+// cfd.inflows. GPU backend only.
+void upload_inflows(Init& init, Cfd& cfd);
 
 void evolve_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd);
 
+// Writes displayTex from the current state; call at most once per frame
+void update_display(Init& init, ComputeHandler& computeHandler, Cfd& cfd);
+
+// Runs one step on the GPU and on the CPU backend from the same state and
+// prints the largest difference per field. Returns the overall maximum.
+float validate_cfd(Init& init, ComputeHandler& computeHandler, Cfd& cfd);
+
 void cleanup(Init& init, Cfd& cfd);
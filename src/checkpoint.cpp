@@ -0,0 +1,324 @@
+#include "checkpoint.hpp"
+#include "readback.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+
+int write_checkpoint(const std::string& filename, const Checkpoint& checkpoint) {
+    std::ostringstream tmp;
+    tmp << filename << ".tmp" << std::hex << std::random_device()();
+    std::error_code error;
+    {
+        std::ofstream file(tmp.str(), std::ios::binary);
+        if (!file.is_open()) {
+            std::cout << "failed to open " << tmp.str() << "\n";
+            return -1;
+        }
+
+        CheckpointHeader header = checkpoint.header;
+        header.nChunks = checkpoint.chunks.size();
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        CompressionStats total;
+        std::vector<unsigned char> compressed;
+        for (const auto& chunk : checkpoint.chunks) {
+            ChunkHeader chunkHeader;
+            std::strncpy(chunkHeader.tag, chunk.first.c_str(), sizeof(chunkHeader.tag));
+            const void* data = chunk.second.data();
+            chunkHeader.size = chunk.second.size() * sizeof(float);
+
+            auto tolerance = checkpoint.tolerances.find(chunk.first);
+            if (tolerance != checkpoint.tolerances.end()) {
+                uint32_t shape[3];
+                field_shape(header.gridSize, chunk.first, chunk.second.size(), shape);
+                CompressionStats stats;
+                if (0 != compress_field(chunk.second.data(), shape[0], shape[1], shape[2], tolerance->second,
+                        compressed, &stats)) {
+                    file.close();
+                    std::filesystem::remove(tmp.str(), error);
+                    return -1;
+                }
+                chunkHeader.tolerance = tolerance->second;
+                data = compressed.data();
+                chunkHeader.size = compressed.size();
+                total.rawBytes += stats.rawBytes;
+                total.compressedBytes += stats.compressedBytes;
+                total.seconds += stats.seconds;
+            }
+
+            chunkHeader.crc = crc32(data, chunkHeader.size);
+            file.write(reinterpret_cast<const char*>(&chunkHeader), sizeof(chunkHeader));
+            file.write(reinterpret_cast<const char*>(data), chunkHeader.size);
+        }
+        if (!file.good()) {
+            std::cout << "failed to write " << tmp.str() << "\n";
+            file.close();
+            std::filesystem::remove(tmp.str(), error);
+            return -1;
+        }
+        if (total.rawBytes > 0) report_compression("checkpoint fields", total);
+    }
+
+    std::filesystem::rename(tmp.str(), filename, error);
+    if (error) {
+        std::cout << "failed to write " << filename << ": " << error.message() << "\n";
+        std::filesystem::remove(tmp.str(), error);
+        return -1;
+    }
+    return 0;
+}
+
+int read_checkpoint(const std::string& filename, Checkpoint& checkpoint) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        std::cout << "failed to open checkpoint " << filename << "\n";
+        return -1;
+    }
+    const uint64_t fileSize = file.tellg();
+    file.seekg(0);
+
+    CheckpointHeader& header = checkpoint.header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, CheckpointHeader().magic, 4) != 0) {
+        std::cout << filename << " is not a checkpoint\n";
+        return -1;
+    }
+    if (header.version < 1 || header.version > 3) {
+        std::cout << "unsupported checkpoint version " << header.version << "\n";
+        return -1;
+    }
+
+    checkpoint.chunks.clear();
+    for (uint32_t c = 0; c < header.nChunks; c++) {
+        ChunkHeader chunkHeader;
+        if (!file.read(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader))) {
+            std::cout << "truncated checkpoint " << filename << "\n";
+            return -1;
+        }
+        // Version 1 wrote zero here
+        bool compressed = header.version >= 2 && chunkHeader.tolerance > 0.0f;
+        std::string tag(chunkHeader.tag, strnlen(chunkHeader.tag, sizeof(chunkHeader.tag)));
+        // A damaged size must not decide how much memory is allocated
+        if (chunkHeader.size > fileSize - uint64_t(file.tellg())) {
+            std::cout << "truncated checkpoint " << filename << "\n";
+            return -1;
+        }
+        std::vector<unsigned char> bytes(chunkHeader.size);
+        if ((!compressed && chunkHeader.size % sizeof(float) != 0) ||
+            !file.read(reinterpret_cast<char*>(bytes.data()), chunkHeader.size)) {
+            std::cout << "truncated checkpoint " << filename << "\n";
+            return -1;
+        }
+        if (crc32(bytes.data(), chunkHeader.size) != chunkHeader.crc) {
+            std::cout << "checksum mismatch in chunk " << tag << " of " << filename << "\n";
+            return -1;
+        }
+
+        std::vector<float> data;
+        if (compressed) {
+            if (0 != decompress_field(bytes.data(), bytes.size(), data)) {
+                std::cout << "damaged chunk " << tag << " in " << filename << "\n";
+                return -1;
+            }
+            checkpoint.tolerances[tag] = chunkHeader.tolerance;
+        } else {
+            data.resize(chunkHeader.size / sizeof(float));
+            std::memcpy(data.data(), bytes.data(), chunkHeader.size);
+        }
+        checkpoint.chunks.emplace_back(tag, std::move(data));
+    }
+    return 0;
+}
+
+std::vector<float> buffer_values(Init& init, buffer& buf) {
+    std::vector<float> values(buf.size / sizeof(float));
+    copy_from_buffer(init, buf, values.data());
+    return values;
+}
+
+std::vector<float> inflow_values(const Cfd& cfd) {
+    std::vector<float> values;
+    for (int m = 0; m < cfd.members; m++) {
+        values.push_back(cfd.ensemble[m].speed);
+        values.push_back(cfd.ensemble[m].direction);
+    }
+    return values;
+}
+
+// Fields that don't change while stepping
+std::vector<std::pair<std::string, std::vector<float>>> static_chunks(Init& init, Cfd& cfd) {
+    std::vector<std::pair<std::string, std::vector<float>>> chunks;
+    chunks.emplace_back("inflows", inflow_values(cfd));
+    if (cfd.backend == Backend::cpu) {
+        chunks.emplace_back("bounds", std::vector<float>(cfd.cpu.boundaries.begin(), cfd.cpu.boundaries.end()));
+        return chunks;
+    }
+    chunks.emplace_back("bounds", buffer_values(init, cfd.boundaries));
+    chunks.emplace_back("apertX", buffer_values(init, cfd.apertureX));
+    chunks.emplace_back("apertY", buffer_values(init, cfd.apertureY));
+    chunks.emplace_back("apertZ", buffer_values(init, cfd.apertureZ));
+    chunks.emplace_back("columns", buffer_values(init, cfd.columnHeights));
+    return chunks;
+}
+
+CheckpointHeader checkpoint_header(const Cfd& cfd) {
+    CheckpointHeader header;
+    header.gridSize = cfd.gridSize;
+    header.members = cfd.members;
+    header.step = cfd.step;
+    // Replaced with the live timestep where cfd.params is saved
+    header.dt = solverDt;
+    // evolve_cfd always ends with the current fields back in the first buffers
+    header.parity = 0;
+    return header;
+}
+
+int save_checkpoint(Init& init, Cfd& cfd, const std::string& filename, const FieldTolerances& tolerances) {
+    Checkpoint checkpoint;
+    checkpoint.header = checkpoint_header(cfd);
+    checkpoint.tolerances = tolerances;
+    if (cfd.backend == Backend::cpu) {
+        checkpoint.chunks.emplace_back("vx", std::vector<float>(cfd.cpu.vx.begin(), cfd.cpu.vx.end()));
+        checkpoint.chunks.emplace_back("vy", std::vector<float>(cfd.cpu.vy.begin(), cfd.cpu.vy.end()));
+        checkpoint.chunks.emplace_back("vz", std::vector<float>(cfd.cpu.vz.begin(), cfd.cpu.vz.end()));
+        checkpoint.chunks.emplace_back("density", std::vector<float>(cfd.cpu.density.begin(), cfd.cpu.density.end()));
+    } else {
+        checkpoint.chunks.emplace_back("vx", buffer_values(init, cfd.vx));
+        checkpoint.chunks.emplace_back("vy", buffer_values(init, cfd.vy));
+        checkpoint.chunks.emplace_back("vz", buffer_values(init, cfd.vz));
+        checkpoint.chunks.emplace_back("density", buffer_values(init, cfd.density));
+        checkpoint.chunks.emplace_back("pressure", buffer_values(init, cfd.pressure));
+        checkpoint.chunks.emplace_back("temp", buffer_values(init, cfd.temperature));
+        checkpoint.chunks.emplace_back("params", buffer_values(init, cfd.params));
+        checkpoint.header.dt = checkpoint.chunks.back().second[0];
+    }
+    for (auto& chunk : static_chunks(init, cfd)) checkpoint.chunks.push_back(std::move(chunk));
+    return write_checkpoint(filename, checkpoint);
+}
+
+int restore_checkpoint(Init& init, Cfd& cfd, const std::string& filename) {
+    Checkpoint checkpoint;
+    if (0 != read_checkpoint(filename, checkpoint)) return -1;
+    const CheckpointHeader& header = checkpoint.header;
+    if (int(header.gridSize) != cfd.gridSize || int(header.members) != cfd.members || header.parity != 0) {
+        std::cout << "checkpoint is for a " << header.gridSize << " grid with " << header.members
+                  << " members, not " << cfd.gridSize << " with " << cfd.members << "\n";
+        return -1;
+    }
+
+    bool hasParams = false;
+    for (const auto& chunk : checkpoint.chunks) {
+        const std::string& tag = chunk.first;
+        const std::vector<float>& values = chunk.second;
+        hasParams = hasParams || tag == "params";
+
+        if (tag == "inflows") {
+            for (int m = 0; m < cfd.members && 2 * m + 1 < int(values.size()); m++) {
+                cfd.ensemble[m].speed = values[2 * m];
+                cfd.ensemble[m].direction = values[2 * m + 1];
+            }
+            continue;
+        }
+
+        if (cfd.backend == Backend::cpu) {
+            CpuField* field = tag == "vx" ? &cfd.cpu.vx : tag == "vy" ? &cfd.cpu.vy : tag == "vz" ? &cfd.cpu.vz :
+                              tag == "density" ? &cfd.cpu.density : tag == "bounds" ? &cfd.cpu.boundaries : nullptr;
+            // Only member 0 is kept on the CPU
+            if (field != nullptr && values.size() >= field->size()) {
+                fill_cpu_field(cfd.cpu, *field, std::vector<float>(values.begin(), values.begin() + field->size()));
+            }
+            continue;
+        }
+
+        buffer* buf = tag == "vx" ? &cfd.vx : tag == "vy" ? &cfd.vy : tag == "vz" ? &cfd.vz :
+                      tag == "density" ? &cfd.density : tag == "pressure" ? &cfd.pressure :
+                      tag == "temp" ? &cfd.temperature : tag == "bounds" ? &cfd.boundaries : tag == "apertX" ? &cfd.apertureX :
+                      tag == "apertY" ? &cfd.apertureY : tag == "apertZ" ? &cfd.apertureZ :
+                      tag == "columns" ? &cfd.columnHeights : tag == "params" ? &cfd.params : nullptr;
+        if (buf == nullptr) continue;
+        if (values.size() * sizeof(float) != buf->size) {
+            std::cout << "checkpoint chunk " << tag << " has the wrong size\n";
+            return -1;
+        }
+        copy_to_buffer(init, *buf, values.data(), 0, buf->size);
+    }
+    if (cfd.backend == Backend::cpu) {
+        update_cpu_masks(cfd.cpu);
+    } else {
+        upload_inflows(init, cfd);
+        // Older checkpoints only have the header's timestep, shared by all members
+        if (!hasParams) {
+            std::vector<SolverParams> params(cfd.members, SolverParams{header.dt, header.step * header.dt, {0.0f, 0.0f}});
+            copy_to_buffer(init, cfd.params, params.data());
+        }
+    }
+
+    cfd.step = header.step;
+    std::cout << "Restored step " << cfd.step << " from " << filename << std::endl;
+    return 0;
+}
+
+// Checkpoints being assembled on the readback thread, by step
+struct CheckpointCollector {
+    std::string filename;
+    CheckpointHeader header;
+    FieldTolerances tolerances;
+    std::vector<std::pair<std::string, std::vector<float>>> staticChunks;
+    std::map<long, std::vector<std::vector<float>>> pending;
+    std::map<long, int> received;
+};
+
+int subscribe_checkpoints(Init& init, Readback& readback, Cfd& cfd, const std::string& filename, int every,
+    const FieldTolerances& tolerances) {
+    const Field fields[] = {Field::vx, Field::vy, Field::vz, Field::density, Field::pressure, Field::temperature};
+    const char* tags[] = {"vx", "vy", "vz", "density", "pressure", "temp", "params"};
+    const int nFields = 6;
+    // Every member of every field, then the params of all members at once
+    const int nParts = nFields * cfd.members + 1;
+
+    auto collector = std::make_shared<CheckpointCollector>();
+    collector->filename = filename;
+    collector->header = checkpoint_header(cfd);
+    collector->tolerances = tolerances;
+    collector->staticChunks = static_chunks(init, cfd);
+    const int members = cfd.members;
+
+    // Part f of a step's checkpoint arrived; the last one writes it
+    auto receive = [collector, members, nParts, tags](int f, long step, int member, const std::vector<float>& values) {
+        std::vector<std::vector<float>>& fields = collector->pending[step];
+        fields.resize(nFields + 1);
+        fields[f].resize(f == nFields ? values.size() : values.size() * members);
+        std::copy(values.begin(), values.end(), fields[f].begin() + (f == nFields ? 0 : member * values.size()));
+        if (++collector->received[step] < nParts) return;
+
+        Checkpoint checkpoint;
+        checkpoint.header = collector->header;
+        checkpoint.header.step = step;
+        checkpoint.header.dt = fields[nFields][0];
+        checkpoint.tolerances = collector->tolerances;
+        for (int i = 0; i <= nFields; i++) checkpoint.chunks.emplace_back(tags[i], std::move(fields[i]));
+        checkpoint.chunks.insert(checkpoint.chunks.end(), collector->staticChunks.begin(), collector->staticChunks.end());
+        collector->pending.erase(step);
+        collector->received.erase(step);
+        if (0 == write_checkpoint(collector->filename, checkpoint)) {
+            std::cout << "Checkpoint at step " << step << std::endl;
+        }
+    };
+
+    for (int f = 0; f < nFields; f++) {
+        for (int m = 0; m < members; m++) {
+            auto part = [receive, f](long step, int member, const std::vector<float>& values) {
+                receive(f, step, member, values);
+            };
+            if (0 != subscribe_field(readback, cfd, fields[f], m, every, part)) return -1;
+        }
+    }
+    auto params = [receive](long step, int member, const std::vector<float>& values) {
+        receive(nFields, step, member, values);
+    };
+    return subscribe_buffer(readback, cfd.params, 0, cfd.params.size, every, params);
+}
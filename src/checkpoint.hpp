@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cfd.hpp"
+#include "crc32.hpp"
+#include "fieldCompression.hpp"
+
+struct Readback;
+
+// Checkpoint file: a CheckpointHeader, then nChunks chunks of a ChunkHeader
+// followed by size bytes of data. Each chunk carries the CRC-32 of its data.
+// Fields are stored as their whole buffers, every ensemble member back to back,
+// either as raw floats or, when the chunk has a tolerance, as compress_field
+// output (version 2 on). From version 3 the GPU backend also stores the
+// SolverParams of every member in a "params" chunk.
+struct CheckpointHeader {
+    char magic[4] = {'T', 'C', 'K', 'P'};
+    uint32_t version = 3;
+    uint32_t gridSize = 0;
+    uint32_t members = 0;
+    int64_t step = 0;
+    // Timestep of member 0 at step
+    float dt = 0.0f;
+    // 0 when the current fields are in vx, density, ...; 1 for vx2, density2, ...
+    uint32_t parity = 0;
+    uint32_t nChunks = 0;
+    uint32_t reserved = 0;
+};
+static_assert(sizeof(CheckpointHeader) == 40, "checkpoint header must stay 40 bytes");
+
+struct ChunkHeader {
+    char tag[8] = {};
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    // 0 for raw floats
+    float tolerance = 0.0f;
+};
+static_assert(sizeof(ChunkHeader) == 24, "checkpoint chunk header must stay 24 bytes");
+
+struct Checkpoint {
+    CheckpointHeader header;
+    std::vector<std::pair<std::string, std::vector<float>>> chunks;
+    // Fields written lossy with compress_field; the rest are stored exactly
+    FieldTolerances tolerances;
+};
+
+// Written to a temporary file and renamed over filename, so a crash while
+// writing keeps the previous checkpoint
+int write_checkpoint(const std::string& filename, const Checkpoint& checkpoint);
+int read_checkpoint(const std::string& filename, Checkpoint& checkpoint);
+
+// Snapshots every live field of cfd and writes it from the calling thread
+int save_checkpoint(Init& init, Cfd& cfd, const std::string& filename, const FieldTolerances& tolerances = {});
+
+// Restores a checkpoint into a cfd set up by init_cfd with the same grid size
+// and ensemble size, replacing load_terrain
+int restore_checkpoint(Init& init, Cfd& cfd, const std::string& filename);
+
+// Checkpoints every `every` steps through readback: the fields are copied
+// after the step and the file is written on the readback thread. Call before
+// start_readback.
+int subscribe_checkpoints(Init& init, Readback& readback, Cfd& cfd, const std::string& filename, int every,
+    const FieldTolerances& tolerances = {});
@@ -0,0 +1,910 @@
+#include "cpuSolver.hpp"
+#include "simd.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+// Constants shared with advect.comp, writeTexture.comp and gaussSiedel.comp
+const float cpuDt = 0.1f;
+const float cpuOverRelaxation = 1.9f;
+
+// The CPUs in our affinity mask, ordered by NUMA node so that neighbouring
+// threads, which own neighbouring slabs, share a node. Cgroup and taskset
+// limits are respected, and CPU numbers need not be contiguous.
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+
+    std::vector<std::pair<int, int>> nodeCpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        // sysfs links each CPU to its node as a nodeN entry; none on non-NUMA kernels
+        int node = 0;
+        std::error_code error;
+        std::filesystem::directory_iterator it("/sys/devices/system/cpu/cpu" + std::to_string(cpu), error);
+        for (; !error && it != std::filesystem::directory_iterator(); it.increment(error)) {
+            std::string name = it->path().filename().string();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+                node = std::atoi(name.c_str() + 4);
+                break;
+            }
+        }
+        nodeCpus.emplace_back(node, cpu);
+    }
+    std::sort(nodeCpus.begin(), nodeCpus.end());
+    for (const auto& nodeCpu : nodeCpus) cpus.push_back(nodeCpu.second);
+#endif
+    return cpus;
+}
+
+// Keeps a thread on one core so the pages it first touches stay local to it
+void pin_thread(std::thread& thread, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+}
+
+void pin_current_thread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+// Wakes parked threads. pushed only changes under idleMutex, so a thread
+// that saw no task can't miss the wakeup between its check and its wait.
+void notify_idle(Scheduler& scheduler) {
+    std::lock_guard<std::mutex> lock(scheduler.idleMutex);
+    scheduler.pushed++;
+    if (scheduler.parked > 0) scheduler.idle.notify_all();
+}
+
+void push_task(Scheduler& scheduler, int thread, int task) {
+    {
+        WorkQueue& queue = *scheduler.queues[thread];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    notify_idle(scheduler);
+}
+
+// Newest task from our own deque, otherwise the oldest from another thread's
+bool pop_task(Scheduler& scheduler, int thread, int& task) {
+    const int n = int(scheduler.queues.size());
+    for (int i = 0; i < (scheduler.steal ? n : 1); i++) {
+        WorkQueue& queue = *scheduler.queues[(thread + i) % n];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        if (i == 0) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        } else {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void work(Scheduler& scheduler, int thread) {
+    while (scheduler.remaining.load() > 0) {
+        long seen = scheduler.pushed.load();
+        int task;
+        if (!pop_task(scheduler, thread, task)) {
+            // Every ready task is taken: sleep until one is pushed or the run ends
+            std::unique_lock<std::mutex> lock(scheduler.idleMutex);
+            scheduler.parked++;
+            scheduler.idle.wait(lock, [&] {
+                return scheduler.pushed.load() != seen || scheduler.remaining.load() == 0;
+            });
+            scheduler.parked--;
+            continue;
+        }
+
+        (*scheduler.job)(task);
+
+        if (scheduler.graph) {
+            for (int next : scheduler.graph->successors[task]) {
+                if (scheduler.pending[next].fetch_sub(1) == 1) push_task(scheduler, scheduler.graph->home[next], next);
+            }
+        }
+        if (scheduler.remaining.fetch_sub(1) == 1) notify_idle(scheduler);
+    }
+}
+
+void worker_loop(Scheduler& scheduler, int thread) {
+    long seen = 0;
+    std::unique_lock<std::mutex> lock(scheduler.mutex);
+    while (true) {
+        scheduler.wake.wait(lock, [&] { return scheduler.stop || scheduler.generation != seen; });
+        if (scheduler.stop) return;
+        seen = scheduler.generation;
+
+        scheduler.busy++;
+        lock.unlock();
+        work(scheduler, thread);
+        lock.lock();
+        if (--scheduler.busy == 0) scheduler.done.notify_all();
+    }
+}
+
+void start_scheduler(Scheduler& scheduler, int nThreads, bool pinThreads) {
+    for (int i = 0; i < nThreads; i++) {
+        scheduler.queues.push_back(std::make_unique<WorkQueue>());
+    }
+    if (pinThreads) scheduler.cpus = allowed_cpus();
+    const size_t nCpus = scheduler.cpus.size();
+    for (int i = 1; i < nThreads; i++) {
+        scheduler.workers.emplace_back(worker_loop, std::ref(scheduler), i);
+        if (nCpus > 0) pin_thread(scheduler.workers.back(), scheduler.cpus[i % nCpus]);
+    }
+}
+
+// graph may be null for nTasks independent tasks
+void run_tasks(Scheduler& scheduler, const TaskGraph* graph, int nTasks, bool steal, const std::function<void(int)>& job) {
+    if (nTasks == 0) return;
+
+    std::unique_lock<std::mutex> lock(scheduler.mutex);
+    scheduler.graph = graph;
+    scheduler.steal = steal;
+    scheduler.job = &job;
+
+    const int n = int(scheduler.queues.size());
+    if (graph) {
+        if (scheduler.pendingSize < size_t(nTasks)) {
+            scheduler.pending = std::make_unique<std::atomic<int>[]>(nTasks);
+            scheduler.pendingSize = nTasks;
+        }
+        for (int t = 0; t < nTasks; t++) {
+            scheduler.pending[t].store(graph->nDependencies[t]);
+            if (graph->nDependencies[t] == 0) push_task(scheduler, graph->home[t], t);
+        }
+    } else {
+        for (int t = 0; t < nTasks; t++) push_task(scheduler, t % n, t);
+    }
+
+    scheduler.remaining.store(nTasks);
+    scheduler.generation++;
+    scheduler.wake.notify_all();
+
+    scheduler.busy++;
+    lock.unlock();
+    // The caller only stays on thread 0's CPU for the run, then gets its own affinity back
+#ifdef __linux__
+    cpu_set_t callerSet;
+    const bool pinCaller = !scheduler.cpus.empty() &&
+        pthread_getaffinity_np(pthread_self(), sizeof(callerSet), &callerSet) == 0;
+    if (pinCaller) pin_current_thread(scheduler.cpus[0]);
+#endif
+    work(scheduler, 0);
+#ifdef __linux__
+    if (pinCaller) pthread_setaffinity_np(pthread_self(), sizeof(callerSet), &callerSet);
+#endif
+    lock.lock();
+    scheduler.busy--;
+    scheduler.done.wait(lock, [&] { return scheduler.busy == 0; });
+    scheduler.graph = nullptr;
+    scheduler.job = nullptr;
+}
+
+void run_graph(Scheduler& scheduler, const TaskGraph& graph, const std::function<void(int)>& job) {
+    run_tasks(scheduler, &graph, int(graph.home.size()), true, job);
+}
+
+void run_jobs(Scheduler& scheduler, int nJobs, const std::function<void(int)>& job) {
+    run_tasks(scheduler, nullptr, nJobs, true, job);
+}
+
+void run_on_threads(Scheduler& scheduler, const std::function<void(int)>& job) {
+    run_tasks(scheduler, nullptr, int(scheduler.queues.size()), false, job);
+}
+
+void stop_scheduler(Scheduler& scheduler) {
+    {
+        std::lock_guard<std::mutex> lock(scheduler.mutex);
+        scheduler.stop = true;
+    }
+    scheduler.wake.notify_all();
+    for (auto& worker : scheduler.workers) worker.join();
+    scheduler.workers.clear();
+    scheduler.queues.clear();
+}
+
+const char* cpu_simd_name() {
+    return LanesN::name;
+}
+
+// Splits [0, count) into roughly equal slabs of z planes, one job per slab
+void for_each_slab(CpuCfd& cfd, int count, const std::function<void(int, int)>& fn) {
+    int nJobs = std::min(count, cfd.nThreads * 4);
+    run_jobs(*cfd.scheduler, nJobs, [&](int j) {
+        fn(count * j / nJobs, count * (j + 1) / nJobs);
+    });
+}
+
+// Runs fn<LanesN> over full vectors of a row and fn<Lanes1> over the tail
+#define FOR_EACH_LANE(N, FN, ...)                                              \
+    {                                                                          \
+        int x_ = 0;                                                            \
+        for (; x_ + LanesN::width <= (N); x_ += LanesN::width) FN<LanesN>(x_, __VA_ARGS__); \
+        for (; x_ < (N); x_++) FN<Lanes1>(x_, __VA_ARGS__);                    \
+    }
+
+template <class L>
+typename L::vf mix(typename L::vf a, typename L::vf b, typename L::vf t) {
+    return a * (L::set(1.0f) - t) + b * t;
+}
+
+// Average of the 8 samples taken by get_full_vel_x/y/z. The x coordinates vary
+// per lane; the y/z part of each index is a scalar offset for the row.
+template <class L>
+typename L::vf corner_average(const float* a, int size, typename L::vi x0, typename L::vi x1,
+    int off00, int off10, int off01, int off11) {
+    typename L::vf v000 = L::gather(a, x0 + off00, size);
+    typename L::vf v100 = L::gather(a, x1 + off00, size);
+    typename L::vf v010 = L::gather(a, x0 + off10, size);
+    typename L::vf v110 = L::gather(a, x1 + off10, size);
+    typename L::vf v001 = L::gather(a, x0 + off01, size);
+    typename L::vf v101 = L::gather(a, x1 + off01, size);
+    typename L::vf v011 = L::gather(a, x0 + off11, size);
+    typename L::vf v111 = L::gather(a, x1 + off11, size);
+    return (v000 + v100 + v010 + v110 + v001 + v101 + v011 + v111) / L::set(8.0f);
+}
+
+// interpolate_velX/Y/Z and trilinearInterpolation_density: clamped trilinear
+// sample of an sx * sy * sz array
+template <class L>
+typename L::vf interpolate(const float* a, int sx, int sy, int sz,
+    typename L::vf px, typename L::vf py, typename L::vf pz) {
+    typename L::vf flx = L::floor(px);
+    typename L::vf fly = L::floor(py);
+    typename L::vf flz = L::floor(pz);
+    typename L::vf fx = px - flx;
+    typename L::vf fy = py - fly;
+    typename L::vf fz = pz - flz;
+
+    typename L::vi x0 = L::to_int(flx);
+    typename L::vi y0 = L::to_int(fly);
+    typename L::vi z0 = L::to_int(flz);
+    typename L::vi x1 = L::clamp(x0 + 1, 0, sx - 1);
+    typename L::vi y1 = L::clamp(y0 + 1, 0, sy - 1);
+    typename L::vi z1 = L::clamp(z0 + 1, 0, sz - 1);
+    x0 = L::clamp(x0, 0, sx - 1);
+    y0 = L::clamp(y0, 0, sy - 1);
+    z0 = L::clamp(z0, 0, sz - 1);
+
+    typename L::vi r00 = y0 * sx + z0 * (sx * sy);
+    typename L::vi r10 = y1 * sx + z0 * (sx * sy);
+    typename L::vi r01 = y0 * sx + z1 * (sx * sy);
+    typename L::vi r11 = y1 * sx + z1 * (sx * sy);
+
+    typename L::vf v000 = L::gather(a, x0 + r00);
+    typename L::vf v100 = L::gather(a, x1 + r00);
+    typename L::vf v010 = L::gather(a, x0 + r10);
+    typename L::vf v110 = L::gather(a, x1 + r10);
+    typename L::vf v001 = L::gather(a, x0 + r01);
+    typename L::vf v101 = L::gather(a, x1 + r01);
+    typename L::vf v011 = L::gather(a, x0 + r11);
+    typename L::vf v111 = L::gather(a, x1 + r11);
+
+    typename L::vf v00 = mix<L>(v000, v100, fx);
+    typename L::vf v10 = mix<L>(v010, v110, fx);
+    typename L::vf v01 = mix<L>(v001, v101, fx);
+    typename L::vf v11 = mix<L>(v011, v111, fx);
+    typename L::vf v0 = mix<L>(v00, v10, fy);
+    typename L::vf v1 = mix<L>(v01, v11, fy);
+    return mix<L>(v0, v1, fz);
+}
+
+struct VelocityArrays {
+    const float* vx;
+    const float* vy;
+    const float* vz;
+    int g;
+    int size;
+};
+
+// Row offsets in each staggered layout, matching get_x/y/z_vel_index
+int x_row(int g, int y, int z) { return y * (g + 1) + z * (g + 1) * g; }
+int y_row(int g, int y, int z) { return y * g + z * (g + 1) * g; }
+int z_row(int g, int y, int z) { return y * g + z * g * g; }
+
+// Each neighbour sample is clamped to the extents of its own staggered layout,
+// as in get_full_vel_x/y/z: g + 1 faces along its axis and g along the others
+template <class L>
+void advect_x_lanes(int x, const VelocityArrays& v, float* out, int y, int z) {
+    const int g = v.g;
+    typename L::vi X = L::iota(x);
+
+    // get_full_vel_x
+    typename L::vi lo = L::clamp(X - 1, 0, g - 1);
+    typename L::vi hi = L::clamp(X, 0, g - 1);
+    int y0 = std::clamp(y, 0, g), y1 = std::clamp(y + 1, 0, g);
+    int z0 = std::clamp(z, 0, g - 1), z1 = std::clamp(z + 1, 0, g - 1);
+    typename L::vf avgVy = corner_average<L>(v.vy, v.size, lo, hi,
+        y_row(g, y0, z0), y_row(g, y1, z0), y_row(g, y0, z1), y_row(g, y1, z1));
+    y1 = std::clamp(y + 1, 0, g - 1);
+    y0 = std::clamp(y, 0, g - 1);
+    z0 = std::clamp(z, 0, g), z1 = std::clamp(z + 1, 0, g);
+    typename L::vf avgVz = corner_average<L>(v.vz, v.size, lo, hi,
+        z_row(g, y0, z0), z_row(g, y1, z0), z_row(g, y0, z1), z_row(g, y1, z1));
+    typename L::vf vx0 = L::load(v.vx + x_row(g, y, z) + x);
+
+    typename L::vf px = L::to_float(X) - vx0 * L::set(cpuDt);
+    typename L::vf py = L::set(float(y)) - avgVy * L::set(cpuDt);
+    typename L::vf pz = L::set(float(z)) - avgVz * L::set(cpuDt);
+    L::store(out + x_row(g, y, z) + x, interpolate<L>(v.vx, g + 1, g, g, px, py, pz));
+}
+
+template <class L>
+void advect_y_lanes(int x, const VelocityArrays& v, float* out, int y, int z) {
+    const int g = v.g;
+    typename L::vi X = L::iota(x);
+
+    // get_full_vel_y
+    typename L::vi lo = L::clamp(X, 0, g);
+    typename L::vi hi = L::clamp(X + 1, 0, g);
+    int y0 = std::clamp(y - 1, 0, g - 1), y1 = std::clamp(y, 0, g - 1);
+    int z0 = std::clamp(z, 0, g - 1), z1 = std::clamp(z + 1, 0, g - 1);
+    typename L::vf avgVx = corner_average<L>(v.vx, v.size, lo, hi,
+        x_row(g, y0, z0), x_row(g, y1, z0), x_row(g, y0, z1), x_row(g, y1, z1));
+    lo = L::clamp(X, 0, g - 1);
+    hi = L::clamp(X + 1, 0, g - 1);
+    z0 = std::clamp(z, 0, g), z1 = std::clamp(z + 1, 0, g);
+    typename L::vf avgVz = corner_average<L>(v.vz, v.size, lo, hi,
+        z_row(g, y0, z0), z_row(g, y1, z0), z_row(g, y0, z1), z_row(g, y1, z1));
+    typename L::vf vy0 = L::load(v.vy + y_row(g, y, z) + x);
+
+    typename L::vf px = L::to_float(X) - avgVx * L::set(cpuDt);
+    typename L::vf py = L::set(float(y)) - vy0 * L::set(cpuDt);
+    typename L::vf pz = L::set(float(z)) - avgVz * L::set(cpuDt);
+    L::store(out + y_row(g, y, z) + x, interpolate<L>(v.vy, g, g + 1, g, px, py, pz));
+}
+
+template <class L>
+void advect_z_lanes(int x, const VelocityArrays& v, float* out, int y, int z) {
+    const int g = v.g;
+    typename L::vi X = L::iota(x);
+
+    // get_full_vel_z
+    typename L::vi lo = L::clamp(X, 0, g);
+    typename L::vi hi = L::clamp(X + 1, 0, g);
+    int y0 = std::clamp(y, 0, g - 1), y1 = std::clamp(y + 1, 0, g - 1);
+    int z0 = std::clamp(z - 1, 0, g - 1), z1 = std::clamp(z, 0, g - 1);
+    typename L::vf avgVx = corner_average<L>(v.vx, v.size, lo, hi,
+        x_row(g, y0, z0), x_row(g, y1, z0), x_row(g, y0, z1), x_row(g, y1, z1));
+    lo = L::clamp(X, 0, g - 1);
+    hi = L::clamp(X + 1, 0, g - 1);
+    y0 = std::clamp(y, 0, g), y1 = std::clamp(y + 1, 0, g);
+    typename L::vf avgVy = corner_average<L>(v.vy, v.size, lo, hi,
+        y_row(g, y0, z0), y_row(g, y1, z0), y_row(g, y0, z1), y_row(g, y1, z1));
+    typename L::vf vz0 = L::load(v.vz + z_row(g, y, z) + x);
+
+    typename L::vf px = L::to_float(X) - avgVx * L::set(cpuDt);
+    typename L::vf py = L::set(float(y)) - avgVy * L::set(cpuDt);
+    typename L::vf pz = L::set(float(z)) - vz0 * L::set(cpuDt);
+    L::store(out + z_row(g, y, z) + x, interpolate<L>(v.vz, g, g, g + 1, px, py, pz));
+}
+
+// Rows [yBegin, yEnd) x [zBegin, zEnd) of all three layouts, within [0, g + 1):
+// the x layout has g rows and planes, the y layout g + 1 rows and the z layout
+// g + 1 planes
+void advect_brick(const VelocityArrays& v, float* vx2, float* vy2, float* vz2, int yBegin, int yEnd, int zBegin, int zEnd) {
+    const int g = v.g;
+    for (int z = zBegin; z < zEnd; z++) {
+        for (int y = yBegin; y < yEnd; y++) {
+            if (z < g && y < g) FOR_EACH_LANE(g + 1, advect_x_lanes, v, vx2, y, z);
+            if (z < g) FOR_EACH_LANE(g, advect_y_lanes, v, vy2, y, z);
+            if (y < g) FOR_EACH_LANE(g, advect_z_lanes, v, vz2, y, z);
+        }
+    }
+}
+
+void cpu_advect(CpuCfd& cfd, const CpuField& vx, const CpuField& vy, const CpuField& vz,
+    CpuField& vx2, CpuField& vy2, CpuField& vz2) {
+    const int g = cfd.gridSize;
+    VelocityArrays v{vx.data(), vy.data(), vz.data(), g, (g + 1) * g * g};
+    for_each_slab(cfd, g + 1, [&](int zBegin, int zEnd) {
+        advect_brick(v, vx2.data(), vy2.data(), vz2.data(), 0, g + 1, zBegin, zEnd);
+    });
+}
+
+template <class L>
+void density_lanes(int x, const CpuCfd& cfd, const float* density, float* density2, int y, int z) {
+    const int g = cfd.gridSize;
+    const int gb = g + 2;
+
+    typename L::vm fluid = L::ne(L::load(cfd.boundaries.data() + (x + 1) + (y + 1) * gb + (z + 1) * gb * gb), 0.0f);
+
+    // cell_vellX/Y/Z
+    const float* vx = cfd.vx.data() + x_row(g, y, z) + x;
+    const float* vy = cfd.vy.data() + y_row(g, y, z) + x;
+    const float* vz = cfd.vz.data() + z_row(g, y, z) + x;
+    typename L::vf cvx = (L::load(vx) + L::load(vx + 1)) * L::set(0.5f);
+    typename L::vf cvy = (L::load(vy) + L::load(vy + g)) * L::set(0.5f);
+    typename L::vf cvz = (L::load(vz) + L::load(vz + g * g)) * L::set(0.5f);
+
+    typename L::vf px = L::to_float(L::iota(x)) - cvx * L::set(cpuDt);
+    typename L::vf py = L::set(float(y)) - cvy * L::set(cpuDt);
+    typename L::vf pz = L::set(float(z)) - cvz * L::set(cpuDt);
+    L::store(density2 + z_row(g, y, z) + x, interpolate<L>(density, g, g, g, px, py, pz), fluid);
+}
+
+// Rows without fluid store nothing and are skipped
+void density_brick(const CpuCfd& cfd, const float* density, float* density2, int yBegin, int yEnd, int zBegin, int zEnd) {
+    const int g = cfd.gridSize;
+    for (int z = zBegin; z < zEnd; z++) {
+        for (int y = yBegin; y < yEnd; y++) {
+            if (!cfd.rowFluid.empty() && !cfd.rowFluid[y + z * g]) continue;
+            FOR_EACH_LANE(g, density_lanes, cfd, density, density2, y, z);
+        }
+    }
+}
+
+void cpu_advect_density(CpuCfd& cfd, const CpuField& density, CpuField& density2) {
+    const int g = cfd.gridSize;
+    for_each_slab(cfd, g, [&](int zBegin, int zEnd) {
+        density_brick(cfd, density.data(), density2.data(), 0, g, zBegin, zEnd);
+    });
+}
+
+// First half of a Gauss-Seidel row: updates the y and z faces of active cells
+// in place and leaves the x face corrections in dLeft/dRight, since neighbouring
+// lanes share x faces. Loads and stores touching y and z faces are masked
+// because those faces are shared with rows that other threads may be updating.
+template <class L>
+void gauss_siedel_lanes(int x, CpuCfd& cfd, int y, int z, int shouldRed, float* dLeft, float* dRight) {
+    const int g = cfd.gridSize;
+    const int gb = g + 2;
+
+    float* vx = cfd.vx.data() + x_row(g, y, z) + x;
+    float* vy = cfd.vy.data() + y_row(g, y, z) + x;
+    float* vz = cfd.vz.data() + z_row(g, y, z) + x;
+    const float* b = cfd.boundaries.data() + (x + 1) + (y + 1) * gb + (z + 1) * gb * gb;
+
+    // Checkerboard colouring, as is_red in gaussSiedel.comp
+    typename L::vm active = L::odd(L::iota(x + y + z));
+    if (shouldRed) active = L::negate(active);
+
+    typename L::vf b100 = L::load(b + 1);
+    typename L::vf bm100 = L::load(b - 1);
+    typename L::vf b010 = L::load(b + gb);
+    typename L::vf bm010 = L::load(b - gb);
+    typename L::vf b001 = L::load(b + gb * gb);
+    typename L::vf bm001 = L::load(b - gb * gb);
+    typename L::vf boundCoeff = b100 + bm100 + b010 + bm010 + b001 + bm001;
+    active = L::both(active, L::ne(boundCoeff, 0.0f));
+
+    typename L::vf vx0 = L::load(vx);
+    typename L::vf vx1 = L::load(vx + 1);
+    typename L::vf vy0 = L::load(vy, active);
+    typename L::vf vy1 = L::load(vy + g, active);
+    typename L::vf vz0 = L::load(vz, active);
+    typename L::vf vz1 = L::load(vz + g * g, active);
+
+    typename L::vf div = L::set(cpuOverRelaxation) * ((vx1 - vx0) + (vy1 - vy0) + (vz1 - vz0));
+    typename L::vf s = L::select(active, div / boundCoeff, L::set(0.0f));
+
+    L::store(dLeft + x, bm100 * s);
+    L::store(dRight + x + 1, L::set(0.0f) - b100 * s);
+
+    L::store(vy, vy0 + bm010 * s, active);
+    L::store(vy + g, vy1 - b010 * s, active);
+    L::store(vz, vz0 + bm001 * s, active);
+    L::store(vz + g * g, vz1 - b001 * s, active);
+}
+
+template <class L>
+void apply_x_lanes(int x, float* vx, const float* dLeft, const float* dRight) {
+    L::store(vx + x, L::load(vx + x) + (L::load(dLeft + x) + L::load(dRight + x)));
+}
+
+// One row of a half sweep; dLeft and dRight are g + 1 floats of scratch. Rows
+// where every cell is surrounded by solid are left unchanged by the GPU too.
+void gauss_siedel_row(CpuCfd& cfd, int y, int z, int shouldRed, float* dLeft, float* dRight) {
+    const int g = cfd.gridSize;
+    if (!cfd.rowCoupled.empty() && !cfd.rowCoupled[y + z * g]) return;
+    dLeft[g] = 0.0f;
+    dRight[0] = 0.0f;
+    FOR_EACH_LANE(g, gauss_siedel_lanes, cfd, y, z, shouldRed, dLeft, dRight);
+    FOR_EACH_LANE(g + 1, apply_x_lanes, cfd.vx.data() + x_row(g, y, z), dLeft, dRight);
+}
+
+void cpu_gauss_siedel(CpuCfd& cfd, int shouldRed) {
+    const int g = cfd.gridSize;
+    for_each_slab(cfd, g, [&](int zBegin, int zEnd) {
+        std::vector<float> dLeft(g + 1), dRight(g + 1);
+        for (int z = zBegin; z < zEnd; z++) {
+            for (int y = 0; y < g; y++) gauss_siedel_row(cfd, y, z, shouldRed, dLeft.data(), dRight.data());
+        }
+    });
+}
+
+// The colouring is a checkerboard, so a half sweep only depends on the face
+// neighbours' previous half sweep. Tile (ty, tz)
+// covers rows [ty * tileY - t, (ty + 1) * tileY - t) at level t of a pass (and
+// the same in z), i.e. a parallelogram skewed by one row per half sweep. Every
+// dependency then points into the same tile at an earlier level or into a
+// tile with smaller ty and tz, so tiles on one anti-diagonal run concurrently
+// and the result is identical to sweeping the whole grid level by level.
+void gauss_siedel_tile(CpuCfd& cfd, int ty, int tz, int firstSweep, int levels, float* dLeft, float* dRight) {
+    const int g = cfd.gridSize;
+    for (int t = 0; t < levels; t++) {
+        int shouldRed = (firstSweep + t) % 2 == 0;
+        int yBegin = std::max(0, ty * cfd.tileY - t), yEnd = std::min(g, (ty + 1) * cfd.tileY - t);
+        int zBegin = std::max(0, tz * cfd.tileZ - t), zEnd = std::min(g, (tz + 1) * cfd.tileZ - t);
+        for (int z = zBegin; z < zEnd; z++) {
+            for (int y = yBegin; y < yEnd; y++) gauss_siedel_row(cfd, y, z, shouldRed, dLeft, dRight);
+        }
+    }
+}
+
+// Thread whose slab holds plane z after init_cpu_cfd's first touch
+int plane_owner(const CpuCfd& cfd, int z) {
+    return std::min(cfd.nThreads - 1, z * cfd.nThreads / (cfd.gridSize + 1));
+}
+
+int task_index(const StepPass& pass, int by, int bz) {
+    return pass.firstTask + by + bz * pass.bricksY;
+}
+
+int add_task(StepGraph& step, const BrickTask& task, int home) {
+    step.tasks.push_back(task);
+    step.graph.home.push_back(home);
+    step.graph.nDependencies.push_back(0);
+    step.graph.successors.emplace_back();
+    return int(step.tasks.size()) - 1;
+}
+
+void depend(StepGraph& step, int task, int on) {
+    step.graph.successors[on].push_back(task);
+    step.graph.nDependencies[task]++;
+}
+
+// Bricks of tileY x tileZ rows covering [0, rows)^2, widened by the skew of a
+// pass with the given number of levels
+const StepPass& add_pass(const CpuCfd& cfd, StepGraph& step, TaskKind kind, int firstSweep, int levels, int rows) {
+    StepPass pass;
+    pass.kind = kind;
+    pass.firstSweep = firstSweep;
+    pass.levels = levels;
+    pass.bricksY = (rows + levels - 1 + cfd.tileY - 1) / cfd.tileY;
+    pass.bricksZ = (rows + levels - 1 + cfd.tileZ - 1) / cfd.tileZ;
+    pass.firstTask = int(step.tasks.size());
+
+    const int passIndex = int(step.passes.size());
+    for (int bz = 0; bz < pass.bricksZ; bz++) {
+        for (int by = 0; by < pass.bricksY; by++) {
+            int home = plane_owner(cfd, std::min(bz * cfd.tileZ, cfd.gridSize));
+            add_task(step, {kind, passIndex, by, bz}, home);
+        }
+    }
+    step.passes.push_back(pass);
+    return step.passes.back();
+}
+
+// A no-op task after every brick of a pass, for passes that read the previous
+// one at arbitrary positions
+int add_join(StepGraph& step, const StepPass& pass) {
+    int join = add_task(step, {TaskKind::join, -1, 0, 0}, 0);
+    for (int t = pass.firstTask; t < pass.firstTask + pass.bricksY * pass.bricksZ; t++) depend(step, join, t);
+    return join;
+}
+
+// Half sweeps as skewed tile passes (see gauss_siedel_tile). Within a pass a
+// tile waits for its -y and -z neighbours; the first level of a tile waits for
+// the tiles of the previous pass that hold the last level of its rows and
+// their face neighbours.
+void add_gauss_siedel_passes(const CpuCfd& cfd, StepGraph& step, int halfSweeps) {
+    const int g = cfd.gridSize;
+    const int sweepsPerPass = cfd.tileSweeps <= 0 ? 1 : cfd.tileSweeps;
+
+    int previous = -1;
+    for (int h = 0; h < halfSweeps; h += sweepsPerPass) {
+        int levels = std::min(sweepsPerPass, halfSweeps - h);
+        const StepPass pass = add_pass(cfd, step, TaskKind::gaussSiedel, h, levels, g);
+
+        for (int bz = 0; bz < pass.bricksZ; bz++) {
+            for (int by = 0; by < pass.bricksY; by++) {
+                int task = task_index(pass, by, bz);
+                if (levels > 1 && by > 0) depend(step, task, task_index(pass, by - 1, bz));
+                if (levels > 1 && bz > 0) depend(step, task, task_index(pass, by, bz - 1));
+
+                if (previous < 0 || by * cfd.tileY >= g || bz * cfd.tileZ >= g) continue;
+                const StepPass& prev = step.passes[previous];
+                int shift = prev.levels - 1;
+                int yLo = (std::max(0, by * cfd.tileY - 1) + shift) / cfd.tileY;
+                int yHi = (std::min(g - 1, (by + 1) * cfd.tileY) + shift) / cfd.tileY;
+                int zLo = (std::max(0, bz * cfd.tileZ - 1) + shift) / cfd.tileZ;
+                int zHi = (std::min(g - 1, (bz + 1) * cfd.tileZ) + shift) / cfd.tileZ;
+                for (int pz = zLo; pz <= zHi; pz++) {
+                    for (int py = yLo; py <= yHi; py++) depend(step, task, task_index(prev, py, pz));
+                }
+            }
+        }
+        previous = int(step.passes.size()) - 1;
+    }
+}
+
+// evolve_cfd as one task graph: the Gauss-Seidel passes, both advections
+// behind joins since they sample anywhere, then the density advection. The
+// first density pass only reads the velocity faces of its own cells, so each
+// brick waits for just the neighbouring bricks of the second advection.
+void build_step_graph(CpuCfd& cfd, StepGraph& step, int halfSweeps, bool gaussSiedelOnly) {
+    const int g = cfd.gridSize;
+    step = StepGraph();
+    step.gridSize = g;
+    step.tileY = cfd.tileY;
+    step.tileZ = cfd.tileZ;
+    step.tileSweeps = cfd.tileSweeps;
+
+    add_gauss_siedel_passes(cfd, step, halfSweeps);
+    if (gaussSiedelOnly) return;
+
+    int join = add_join(step, step.passes.back());
+    const StepPass advect = add_pass(cfd, step, TaskKind::advect, 0, 1, g + 1);
+    for (int t = advect.firstTask; t < advect.firstTask + advect.bricksY * advect.bricksZ; t++) depend(step, t, join);
+
+    join = add_join(step, advect);
+    const StepPass advect2 = add_pass(cfd, step, TaskKind::advect2, 0, 1, g + 1);
+    for (int t = advect2.firstTask; t < advect2.firstTask + advect2.bricksY * advect2.bricksZ; t++) depend(step, t, join);
+
+    const StepPass density = add_pass(cfd, step, TaskKind::density, 0, 1, g);
+    for (int bz = 0; bz < density.bricksZ; bz++) {
+        for (int by = 0; by < density.bricksY; by++) {
+            int yHi = std::min(g, (by + 1) * cfd.tileY) / cfd.tileY;
+            int zHi = std::min(g, (bz + 1) * cfd.tileZ) / cfd.tileZ;
+            for (int pz = bz; pz <= zHi; pz++) {
+                for (int py = by; py <= yHi; py++) depend(step, task_index(density, by, bz), task_index(advect2, py, pz));
+            }
+        }
+    }
+
+    join = add_join(step, density);
+    const StepPass density2 = add_pass(cfd, step, TaskKind::density2, 0, 1, g);
+    for (int t = density2.firstTask; t < density2.firstTask + density2.bricksY * density2.bricksZ; t++) depend(step, t, join);
+}
+
+void run_step_task(CpuCfd& cfd, const StepGraph& step, int index) {
+    const BrickTask& task = step.tasks[index];
+    if (task.kind == TaskKind::join) return;
+
+    const int g = cfd.gridSize;
+    const StepPass& pass = step.passes[task.pass];
+    const int yBegin = task.brickY * cfd.tileY, yEnd = yBegin + cfd.tileY;
+    const int zBegin = task.brickZ * cfd.tileZ, zEnd = zBegin + cfd.tileZ;
+
+    thread_local std::vector<float> dLeft, dRight;
+    VelocityArrays v{cfd.vx.data(), cfd.vy.data(), cfd.vz.data(), g, (g + 1) * g * g};
+    VelocityArrays v2{cfd.vx2.data(), cfd.vy2.data(), cfd.vz2.data(), g, (g + 1) * g * g};
+
+    switch (task.kind) {
+    case TaskKind::gaussSiedel:
+        dLeft.resize(g + 1);
+        dRight.resize(g + 1);
+        gauss_siedel_tile(cfd, task.brickY, task.brickZ, pass.firstSweep, pass.levels, dLeft.data(), dRight.data());
+        break;
+    case TaskKind::advect:
+        advect_brick(v, cfd.vx2.data(), cfd.vy2.data(), cfd.vz2.data(),
+            yBegin, std::min(yEnd, g + 1), zBegin, std::min(zEnd, g + 1));
+        break;
+    case TaskKind::advect2:
+        advect_brick(v2, cfd.vx.data(), cfd.vy.data(), cfd.vz.data(),
+            yBegin, std::min(yEnd, g + 1), zBegin, std::min(zEnd, g + 1));
+        break;
+    case TaskKind::density:
+        density_brick(cfd, cfd.density.data(), cfd.density2.data(), yBegin, std::min(yEnd, g), zBegin, std::min(zEnd, g));
+        break;
+    case TaskKind::density2:
+        density_brick(cfd, cfd.density2.data(), cfd.density.data(), yBegin, std::min(yEnd, g), zBegin, std::min(zEnd, g));
+        break;
+    case TaskKind::join:
+        break;
+    }
+}
+
+void cpu_gauss_siedel_tiled(CpuCfd& cfd, int halfSweeps) {
+    StepGraph step;
+    build_step_graph(cfd, step, halfSweeps, true);
+    run_graph(*cfd.scheduler, step.graph, [&](int task) { run_step_task(cfd, step, task); });
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Triad over arrays well beyond the last level cache, in bytes per second
+double measure_stream_bandwidth(CpuCfd& cfd) {
+    const size_t n = size_t(1) << 23;
+    std::vector<float> a(n), b(n, 1.0f), c(n, 2.0f);
+    const int nJobs = cfd.nThreads;
+    auto triad = [&](int j) {
+        size_t begin = n * j / nJobs, end = n * (j + 1) / nJobs;
+        for (size_t i = begin; i < end; i++) a[i] = b[i] + 0.5f * c[i];
+    };
+
+    run_jobs(*cfd.scheduler, nJobs, triad);
+    double best = 1e30;
+    for (int rep = 0; rep < 5; rep++) {
+        auto start = std::chrono::steady_clock::now();
+        run_jobs(*cfd.scheduler, nJobs, triad);
+        best = std::min(best, seconds_since(start));
+    }
+    return 3.0 * sizeof(float) * n / best;
+}
+
+template <class L>
+void flops_kernel(int iterations, float* sink) {
+    typename L::vf acc[8];
+    for (int k = 0; k < 8; k++) acc[k] = L::set(float(k));
+    typename L::vf mul = L::set(0.999999f), add = L::set(1.0e-7f);
+    for (int i = 0; i < iterations; i++) {
+        for (int k = 0; k < 8; k++) acc[k] = acc[k] * mul + add;
+    }
+    for (int k = 1; k < 8; k++) acc[0] = acc[0] + acc[k];
+    *sink = L::hsum(acc[0]);
+}
+
+// Independent multiply-add chains on every thread, in flops per second
+double measure_peak_flops(CpuCfd& cfd) {
+    const int iterations = 1 << 22;
+    std::vector<float> sink(cfd.nThreads);
+    auto start = std::chrono::steady_clock::now();
+    run_jobs(*cfd.scheduler, cfd.nThreads, [&](int j) { flops_kernel<LanesN>(iterations, &sink[j]); });
+    return 2.0 * 8 * LanesN::width * double(iterations) * cfd.nThreads / seconds_since(start);
+}
+
+// Per cell and half sweep: 24 flops for the active half of the cells, and one
+// read of vx, vy, vz and the boundary mask plus one write of the velocities
+// per pass over memory.
+const double gaussSiedelFlops = 12.0;
+const double gaussSiedelBytes = 28.0;
+
+void report_gauss_siedel(CpuCfd& cfd, const char* label, double seconds, int halfSweeps, int sweepsPerPass) {
+    double cells = double(cfd.gridSize) * cfd.gridSize * cfd.gridSize;
+    double flops = gaussSiedelFlops * cells * halfSweeps;
+    double bytes = gaussSiedelBytes * cells * halfSweeps / sweepsPerPass;
+    double intensity = gaussSiedelFlops * sweepsPerPass / gaussSiedelBytes;
+    double roof = std::min(cfd.peakFlops, intensity * cfd.streamBandwidth);
+    std::cout << label << ": " << flops / seconds * 1e-9 << " GFLOP/s, " << bytes / seconds * 1e-9 << " GB/s, "
+              << "roofline " << roof * 1e-9 << " GFLOP/s at " << intensity << " flop/byte\n";
+}
+
+void tune_gauss_siedel(CpuCfd& cfd) {
+    const int halfSweeps = 20;
+    cfd.streamBandwidth = measure_stream_bandwidth(cfd);
+    cfd.peakFlops = measure_peak_flops(cfd);
+    std::cout << "CPU roofline: " << cfd.peakFlops * 1e-9 << " GFLOP/s peak, "
+              << cfd.streamBandwidth * 1e-9 << " GB/s stream\n";
+
+    CpuField vx = cfd.vx, vy = cfd.vy, vz = cfd.vz;
+    auto time_sweeps = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        cpu_gauss_siedel_tiled(cfd, halfSweeps);
+        double seconds = seconds_since(start);
+        cfd.vx = vx, cfd.vy = vy, cfd.vz = vz;
+        return seconds;
+    };
+
+    cfd.tileSweeps = 0;
+    report_gauss_siedel(cfd, "Gauss-Seidel untiled", time_sweeps(), halfSweeps, 1);
+
+    const int sizes[][2] = {{8, 8}, {16, 8}, {16, 16}, {32, 16}, {32, 32}};
+    const int sweeps[] = {1, 2, 4, 10};
+    double best = 1e30;
+    int bestY = 0, bestZ = 0, bestSweeps = 0;
+    for (auto& size : sizes) {
+        for (int k : sweeps) {
+            cfd.tileY = size[0], cfd.tileZ = size[1], cfd.tileSweeps = k;
+            double seconds = time_sweeps();
+            if (seconds < best) {
+                best = seconds;
+                bestY = size[0], bestZ = size[1], bestSweeps = k;
+            }
+        }
+    }
+
+    cfd.tileY = bestY, cfd.tileZ = bestZ, cfd.tileSweeps = bestSweeps;
+    std::string label = "Gauss-Seidel tiled " + std::to_string(bestY) + "x" + std::to_string(bestZ) +
+                        ", " + std::to_string(bestSweeps) + " sweeps per pass";
+    report_gauss_siedel(cfd, label.c_str(), best, halfSweeps, bestSweeps);
+}
+
+void init_cpu_cfd(CpuCfd& cfd, int gridSize) {
+    cfd.gridSize = gridSize;
+    if (cfd.nThreads <= 0) cfd.nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    cfd.scheduler = std::make_shared<Scheduler>();
+    start_scheduler(*cfd.scheduler, cfd.nThreads, cfd.pinThreads);
+
+    const size_t cells = size_t(gridSize) * gridSize * gridSize;
+    const size_t velCells = size_t(gridSize + 1) * gridSize * gridSize;
+    const size_t boarderCells = size_t(gridSize + 2) * (gridSize + 2) * (gridSize + 2);
+
+    // Sized without being written; fill_cpu_field then touches each slab from its owner
+    std::vector<float> zeros;
+    for (CpuField* field : {&cfd.vx, &cfd.vy, &cfd.vz, &cfd.vx2, &cfd.vy2, &cfd.vz2}) {
+        field->resize(velCells);
+        fill_cpu_field(cfd, *field, zeros);
+    }
+    for (CpuField* field : {&cfd.density, &cfd.density2}) {
+        field->resize(cells);
+        fill_cpu_field(cfd, *field, zeros);
+    }
+    cfd.boundaries.resize(boarderCells);
+    fill_cpu_field(cfd, cfd.boundaries, zeros);
+
+    cfd.rowFluid.clear();
+    cfd.rowCoupled.clear();
+}
+
+void fill_cpu_field(CpuCfd& cfd, CpuField& field, const std::vector<float>& values) {
+    // Every layout has at most g + 1 planes of equal size
+    const size_t plane = (field.size() + cfd.gridSize) / (cfd.gridSize + 1);
+    run_on_threads(*cfd.scheduler, [&](int thread) {
+        size_t begin = field.size(), end = 0;
+        for (int z = 0; z <= cfd.gridSize; z++) {
+            if (plane_owner(cfd, z) != thread) continue;
+            begin = std::min(begin, z * plane);
+            end = std::max(end, std::min(field.size(), (z + 1) * plane));
+        }
+        for (size_t i = begin; i < end; i++) field[i] = values.empty() ? 0.0f : values[i];
+    });
+}
+
+void update_cpu_masks(CpuCfd& cfd) {
+    const int g = cfd.gridSize;
+    const int gb = g + 2;
+    cfd.rowFluid.assign(size_t(g) * g, 0);
+    cfd.rowCoupled.assign(size_t(g) * g, 0);
+
+    for_each_slab(cfd, g, [&](int zBegin, int zEnd) {
+        for (int z = zBegin; z < zEnd; z++) {
+            for (int y = 0; y < g; y++) {
+                const float* b = cfd.boundaries.data() + 1 + (y + 1) * gb + (z + 1) * gb * gb;
+                char fluid = 0, coupled = 0;
+                for (int x = 0; x < g; x++) {
+                    fluid |= b[x] != 0.0f;
+                    coupled |= (b[x + 1] + b[x - 1] + b[x + gb] + b[x - gb] + b[x + gb * gb] + b[x - gb * gb]) != 0.0f;
+                }
+                cfd.rowFluid[y + z * g] = fluid;
+                cfd.rowCoupled[y + z * g] = coupled;
+            }
+        }
+    });
+}
+
+// Same pass order as evolve_cfd
+void evolve_cpu_cfd(CpuCfd& cfd) {
+    StepGraph& step = cfd.step;
+    if (step.gridSize != cfd.gridSize || step.tileY != cfd.tileY || step.tileZ != cfd.tileZ ||
+        step.tileSweeps != cfd.tileSweeps) {
+        // 10 red/black iterations
+        build_step_graph(cfd, step, 20, false);
+    }
+    run_graph(*cfd.scheduler, step.graph, [&](int task) { run_step_task(cfd, step, task); });
+}
+
+void cleanup(CpuCfd& cfd) {
+    if (cfd.scheduler) stop_scheduler(*cfd.scheduler);
+    cfd.scheduler.reset();
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Leaves elements uninitialised on resize, so each page is placed on the NUMA
+// node of the first thread that writes to it rather than the allocating one
+template <class T>
+struct FirstTouchAllocator {
+    using value_type = T;
+
+    FirstTouchAllocator() = default;
+    template <class U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { ::operator delete(p); }
+
+    template <class U>
+    void construct(U* p) { ::new (static_cast<void*>(p)) U; }
+    template <class U, class... Args>
+    void construct(U* p, Args&&... args) { ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...); }
+};
+
+template <class T, class U>
+bool operator==(const FirstTouchAllocator<T>&, const FirstTouchAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const FirstTouchAllocator<T>&, const FirstTouchAllocator<U>&) { return false; }
+
+using CpuField = std::vector<float, FirstTouchAllocator<float>>;
+
+// Tasks with dependency counts. A task becomes ready once every task it
+// depends on has finished, and is queued on its home thread.
+struct TaskGraph {
+    std::vector<int> home;
+    std::vector<int> nDependencies;
+    std::vector<std::vector<int>> successors;
+};
+
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<int> tasks;
+};
+
+// Work-stealing scheduler: one deque per thread, the owner pops from the back
+// and idle threads steal from the front of the others. Thread 0 is the caller.
+struct Scheduler {
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    long generation = 0;
+    int busy = 0;
+    bool stop = false;
+
+    const TaskGraph* graph = nullptr;
+    const std::function<void(int)>* job = nullptr;
+    bool steal = true;
+    std::unique_ptr<std::atomic<int>[]> pending;
+    size_t pendingSize = 0;
+    std::atomic<int> remaining{0};
+
+    // Threads with nothing to pop park here until a task is pushed or the run ends
+    std::mutex idleMutex;
+    std::condition_variable idle;
+    std::atomic<long> pushed{0};
+    int parked = 0;
+
+    // CPUs the process may use, grouped by NUMA node. Thread i is pinned to
+    // cpus[i % cpus.size()], the caller only while it runs tasks. Empty when
+    // threads aren't pinned.
+    std::vector<int> cpus;
+};
+
+enum class TaskKind {
+    gaussSiedel,
+    advect,
+    advect2,
+    density,
+    density2,
+    join
+};
+
+// One brick of one pass of a solver step
+struct BrickTask {
+    TaskKind kind;
+    int pass;
+    int brickY;
+    int brickZ;
+};
+
+struct StepPass {
+    TaskKind kind;
+    int firstSweep;
+    int levels;
+    int bricksY;
+    int bricksZ;
+    int firstTask;
+};
+
+struct StepGraph {
+    TaskGraph graph;
+    std::vector<BrickTask> tasks;
+    std::vector<StepPass> passes;
+
+    // Settings the graph was built for
+    int gridSize = 0;
+    int tileY = 0;
+    int tileZ = 0;
+    int tileSweeps = -1;
+};
+
+// CPU mirror of the GPU solver state. Fields use exactly the same layouts as
+// the storage buffers in Cfd so they can be copied across unchanged.
+struct CpuCfd {
+    int gridSize = 0;
+    int nThreads = 0;
+    bool pinThreads = true;
+
+    // Skewed Gauss-Seidel tiles, set by tune_gauss_siedel; tileSweeps = 0 sweeps untiled.
+    // Advection and density bricks use the same tileY x tileZ rows.
+    int tileY = 16;
+    int tileZ = 16;
+    int tileSweeps = 0;
+
+    // Measured by tune_gauss_siedel, in bytes/s and flops/s
+    double streamBandwidth = 0.0;
+    double peakFlops = 0.0;
+
+    CpuField boundaries;
+
+    CpuField vx;
+    CpuField vy;
+    CpuField vz;
+
+    CpuField vx2;
+    CpuField vy2;
+    CpuField vz2;
+
+    CpuField density;
+    CpuField density2;
+
+    // Per (y, z) row: any fluid cell, and any cell the Gauss-Seidel update changes.
+    // Filled by update_cpu_masks; empty means every row is processed.
+    std::vector<char> rowFluid;
+    std::vector<char> rowCoupled;
+
+    std::shared_ptr<Scheduler> scheduler;
+    StepGraph step;
+};
+
+void start_scheduler(Scheduler& scheduler, int nThreads, bool pinThreads);
+// Runs every task of graph, calling job(task) on whichever thread picks it up
+void run_graph(Scheduler& scheduler, const TaskGraph& graph, const std::function<void(int)>& job);
+// Independent jobs [0, nJobs), job j starting on thread j % nThreads
+void run_jobs(Scheduler& scheduler, int nJobs, const std::function<void(int)>& job);
+// job(thread) once on every thread, without stealing
+void run_on_threads(Scheduler& scheduler, const std::function<void(int)>& job);
+void stop_scheduler(Scheduler& scheduler);
+
+const char* cpu_simd_name();
+
+void init_cpu_cfd(CpuCfd& cfd, int gridSize);
+
+// Copies values into a field in place, by the threads owning each slab
+void fill_cpu_field(CpuCfd& cfd, CpuField& field, const std::vector<float>& values);
+
+// Recomputes rowFluid and rowCoupled; call after changing boundaries
+void update_cpu_masks(CpuCfd& cfd);
+
+// One red or black half sweep of gaussSiedel.comp
+void cpu_gauss_siedel(CpuCfd& cfd, int shouldRed);
+
+// halfSweeps alternating half sweeps starting with red, applying tileSweeps of
+// them per pass over each cache-sized tile
+void cpu_gauss_siedel_tiled(CpuCfd& cfd, int halfSweeps);
+
+// Measures the machine roofline, times candidate tilings on the current state
+// (which is restored afterwards) and keeps the fastest
+void tune_gauss_siedel(CpuCfd& cfd);
+
+// advect.comp: (vx, vy, vz) -> (vx2, vy2, vz2), reading and writing the given arrays
+void cpu_advect(CpuCfd& cfd, const CpuField& vx, const CpuField& vy, const CpuField& vz,
+    CpuField& vx2, CpuField& vy2, CpuField& vz2);
+
+// writeTexture.comp without the image write: density -> density2 using (vx, vy, vz)
+void cpu_advect_density(CpuCfd& cfd, const CpuField& density, CpuField& density2);
+
+// One solver step as a single task graph, see build_step_graph
+void evolve_cpu_cfd(CpuCfd& cfd);
+
+void cleanup(CpuCfd& cfd);
@@ -0,0 +1,38 @@
+#include "crc32.hpp"
+
+#include <array>
+#include <cstring>
+
+// Slicing-by-8 tables for the reflected CRC-32 polynomial
+std::array<std::array<uint32_t, 256>, 8> crc32_tables() {
+    std::array<std::array<uint32_t, 256>, 8> tables;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        tables[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xff];
+        }
+    }
+    return tables;
+}
+
+uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+    static const std::array<std::array<uint32_t, 256>, 8> t = crc32_tables();
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    while (size >= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, p, 4);
+        std::memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+              t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
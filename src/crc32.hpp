@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Reflected CRC-32 (zlib, PNG), sliced by 8 bytes. Pass a previous result as
+// crc to continue over more data.
+uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
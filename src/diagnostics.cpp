@@ -0,0 +1,66 @@
+#include "diagnostics.hpp"
+
+#include <cstring>
+
+// local_size_x of diagnostics.comp
+const int diagnosticsWorkSize = 256;
+// Enough workgroups to fill the device; beyond this each thread strides
+// over more cells rather than adding partials
+const int maxDiagnosticsGroups = 512;
+
+int start_diagnostics(Init& init, ComputeHandler& computeHandler, Readback& readback, Cfd& cfd,
+    Diagnostics& diagnostics, int every, DiagnosticsCallback callback) {
+    if (cfd.backend != Backend::gpu) {
+        std::cout << "diagnostics need the GPU backend\n";
+        return -1;
+    }
+    if (!init.subgroupArithmetic) {
+        std::cout << "diagnostics need subgroup arithmetic in compute shaders\n";
+        return -1;
+    }
+
+    const int cells = cfd.gridSize * cfd.gridSize * cfd.gridSize;
+    diagnostics.nGroups = std::min(maxDiagnosticsGroups, (cells + diagnosticsWorkSize - 1) / diagnosticsWorkSize);
+    diagnostics.partials = create_compute_buffer(init, uint64_t(8) * diagnostics.nGroups * cfd.members * sizeof(float));
+    diagnostics.counters = create_compute_buffer(init, cfd.members * sizeof(uint32_t));
+    diagnostics.results = create_compute_buffer(init, cfd.members * sizeof(DiagnosticsResult));
+    std::vector<uint32_t> zeros(cfd.members, 0);
+    copy_to_buffer(init, diagnostics.counters, zeros.data());
+    std::vector<DiagnosticsResult> results(cfd.members, DiagnosticsResult{});
+    copy_to_buffer(init, diagnostics.results, results.data());
+
+    DiagnosticsPushConstants pushConsts{cfd.gridSize, diagnostics.nGroups, cfd.cfl, minSolverDt, maxSolverDt};
+    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, cfd.density, cfd.boundaries, diagnostics.partials,
+        diagnostics.counters, diagnostics.results, cfd.params, cfd.apertureX, cfd.apertureY, cfd.apertureZ};
+    std::vector<texture> textures;
+    VkShaderModule shaderDiagnostics = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/diagnostics.spv"));
+    diagnostics.kernDiagnostics = build_compute_kernal(init, computeHandler, shaderDiagnostics, buffers, textures,
+        &pushConsts, sizeof(pushConsts), diagnostics.nGroups, cfd.members);
+    init.disp.destroyShaderModule(shaderDiagnostics, nullptr);
+
+    cfd.diagnostics = &diagnostics;
+    if (every == 0) return 0;
+
+    auto receive = [callback](long step, int, const std::vector<float>& values) {
+        const size_t perMember = sizeof(DiagnosticsResult) / sizeof(float);
+        for (size_t m = 0; m * perMember < values.size(); m++) {
+            DiagnosticsResult result;
+            std::memcpy(&result, &values[m * perMember], sizeof(result));
+            callback(step, m, result);
+        }
+    };
+    return subscribe_buffer(readback, diagnostics.results, 0, diagnostics.results.size, every, receive);
+}
+
+void run_diagnostics(Init& init, ComputeHandler& computeHandler, Diagnostics& diagnostics) {
+    execute_kernel(init, computeHandler, diagnostics.kernDiagnostics);
+}
+
+void cleanup(Init& init, Cfd& cfd, Diagnostics& diagnostics) {
+    if (diagnostics.nGroups == 0) return;
+    if (cfd.diagnostics == &diagnostics) cfd.diagnostics = nullptr;
+    cleanup(init, diagnostics.kernDiagnostics);
+    std::vector<buffer> buffers = {diagnostics.partials, diagnostics.counters, diagnostics.results};
+    cleanup(init, buffers);
+    diagnostics.nGroups = 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <functional>
+
+#include "cfd.hpp"
+#include "readback.hpp"
+
+// Global diagnostics of one member over its fluid cells, as written by
+// diagnostics.comp: 64 bytes so a step of every member is one small copy
+struct DiagnosticsResult {
+    // Sum of |v|^2 / 2 of the cell-centred velocities
+    float kineticEnergy;
+    float maxSpeed;
+    // Largest aperture-weighted |div v| of a cell, the pressure solve's residual
+    float maxDivergence;
+    // Sum of density, constant while mass is conserved
+    float mass;
+    float fluidCells;
+    // Timestep of the step and simulated time at its end
+    float dt;
+    float time;
+    float reserved[9];
+};
+static_assert(sizeof(DiagnosticsResult) == 64, "diagnostics result must stay 64 bytes");
+
+// Called on the readback thread once per member of each step read back
+using DiagnosticsCallback = std::function<void(long step, int member, const DiagnosticsResult& result)>;
+
+// Every step kernDiagnostics reduces all the metrics in one pass over the
+// fields: subgroup sums and maxima, a shared-memory pass over the subgroups,
+// then the last workgroup of each member to finish reduces the workgroups'
+// partials into results. The results are read back through readback. With
+// cfd.cfl set, the same workgroup also sizes the next step's dt in
+// cfd.params from the max speed, with no round trip to the host.
+struct Diagnostics {
+    int nGroups = 0;
+    buffer partials{};
+    buffer counters{};
+    buffer results{};
+    kernel kernDiagnostics;
+};
+
+struct DiagnosticsPushConstants {
+    int gridSize;
+    int nGroups;
+    float cfl;
+    float minDt;
+    float maxDt;
+};
+
+// Reads the results back every `every` steps, or never for 0 (the adaptive
+// timestep alone). Call before start_readback. GPU backend only, and needs
+// subgroup arithmetic.
+int start_diagnostics(Init& init, ComputeHandler& computeHandler, Readback& readback, Cfd& cfd,
+    Diagnostics& diagnostics, int every, DiagnosticsCallback callback);
+
+// Reduces the current step; called by evolve_cfd
+void run_diagnostics(Init& init, ComputeHandler& computeHandler, Diagnostics& diagnostics);
+
+void cleanup(Init& init, Cfd& cfd, Diagnostics& diagnostics);
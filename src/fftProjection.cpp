@@ -0,0 +1,179 @@
+#include "fftProjection.hpp"
+
+// local_size_x of poissonFft.comp and fftStage.comp
+const int fftWorkSize = 32;
+
+// Radix 4 stages first, then the remaining prime factors in increasing order
+std::vector<int> fft_radices(int n) {
+    std::vector<int> radices;
+    while (n % 4 == 0) {
+        radices.push_back(4);
+        n /= 4;
+    }
+    for (int p = 2; n > 1; p++) {
+        while (n % p == 0) {
+            radices.push_back(p);
+            n /= p;
+        }
+    }
+    return radices;
+}
+
+int start_fft_projection(Init& init, ComputeHandler& computeHandler, Cfd& cfd, FftProjection& fft, int sweeps) {
+    if (cfd.backend != Backend::gpu) {
+        std::cout << "the FFT projection needs the GPU backend\n";
+        return -1;
+    }
+    const int gridSize = cfd.gridSize;
+    const int length = gridSize / 2;
+    fft.radices = fft_radices(length);
+    if (gridSize % 2 != 0 || (!fft.radices.empty() && fft.radices.back() > maxFftRadix)) {
+        std::cout << "the FFT projection needs an even grid size whose half has no prime factor above "
+                  << maxFftRadix << ", e.g. 64, 96 or 128, not " << gridSize << "\n";
+        return -1;
+    }
+    fft.sweeps = std::max(0, sweeps);
+
+    const uint64_t cells = uint64_t(gridSize) * gridSize * gridSize;
+    fft.scratchA = create_compute_buffer(init, 2 * sizeof(float) * cells * cfd.members);
+    fft.scratchB = create_compute_buffer(init, 2 * sizeof(float) * cells * cfd.members);
+
+    VkShaderModule shaderPoisson = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/poissonFft.spv"));
+    VkShaderModule shaderStage = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/fftStage.spv"));
+    std::vector<texture> textures;
+    const int nThreadsCells = (cells + fftWorkSize - 1) / fftWorkSize;
+    const int nThreadsVel = ((gridSize+1) * gridSize * gridSize + fftWorkSize - 1) / fftWorkSize;
+
+    // Each pass reads the buffer the previous one wrote and writes the other
+    buffer* src = &fft.scratchB;
+    buffer* dst = &fft.scratchA;
+    auto add_pass = [&](FftMode mode, int axis) {
+        FftPoissonPushConstants pushConsts{gridSize, int(mode), axis};
+        std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, cfd.boundaries, *src, *dst};
+        const int nThreads = mode == FftMode::gradient ? nThreadsVel : nThreadsCells;
+        fft.passes.push_back(build_compute_kernal(init, computeHandler, shaderPoisson, buffers, textures,
+            &pushConsts, sizeof(pushConsts), nThreads, cfd.members));
+        std::swap(src, dst);
+    };
+    auto add_fft = [&](int axis) {
+        int span = 1;
+        for (int radix : fft.radices) {
+            FftStagePushConstants pushConsts{gridSize, axis, radix, span, length};
+            std::vector<buffer> buffers = {*src, *dst};
+            const int nThreads = (gridSize * gridSize * (length / radix) + fftWorkSize - 1) / fftWorkSize;
+            fft.passes.push_back(build_compute_kernal(init, computeHandler, shaderStage, buffers, textures,
+                &pushConsts, sizeof(pushConsts), nThreads, cfd.members));
+            std::swap(src, dst);
+            span *= radix;
+        }
+    };
+
+    // The DCT-IV is its own inverse, so both ways run the same passes
+    auto add_dct = [&]() {
+        for (int axis = 0; axis < 3; axis++) {
+            add_pass(FftMode::pack, axis);
+            add_fft(axis);
+            add_pass(FftMode::unpack, axis);
+        }
+    };
+
+    add_pass(FftMode::divergence, 0);
+    add_dct();
+    add_pass(FftMode::solve, 0);
+    add_dct();
+    add_pass(FftMode::gradient, 0);
+
+    init.disp.destroyShaderModule(shaderPoisson, nullptr);
+    init.disp.destroyShaderModule(shaderStage, nullptr);
+
+    cfd.fftProjection = &fft;
+    return 0;
+}
+
+void run_fft_projection(Init& init, ComputeHandler& computeHandler, Cfd& cfd, FftProjection& fft) {
+    for (kernel& pass : fft.passes) {
+        execute_kernel(init, computeHandler, pass);
+    }
+    for (int i = 0; i < fft.sweeps; i++) {
+        execute_kernel(init, computeHandler, cfd.kernGaussSiedel);
+    }
+}
+
+// RMS and largest magnitude of member 0's divergence over the fluid cells
+std::pair<double, double> fluid_divergence(Init& init, Cfd& cfd) {
+    std::vector<float> vx, vy, vz, density;
+    read_member_fields(init, cfd, 0, vx, vy, vz, density);
+    std::vector<float> bounds(cfd.boundaries.size / sizeof(float));
+    std::vector<float> ax(bounds.size()), ay(bounds.size()), az(bounds.size());
+    copy_from_buffer(init, cfd.boundaries, bounds.data());
+    copy_from_buffer(init, cfd.apertureX, ax.data());
+    copy_from_buffer(init, cfd.apertureY, ay.data());
+    copy_from_buffer(init, cfd.apertureZ, az.data());
+
+    // Face fluxes weighted by their apertures, as in gaussSiedel.comp
+    const int g = cfd.gridSize;
+    const int sy = g + 2, sz = (g + 2) * (g + 2);
+    double sum = 0.0, largest = 0.0;
+    long cells = 0;
+    for (int z = 0; z < g; z++) {
+        for (int y = 0; y < g; y++) {
+            for (int x = 0; x < g; x++) {
+                int self = (x + 1) + sy * (y + 1) + sz * (z + 1);
+                if (bounds[self] == 0.0f) continue;
+                double div = ax[self + 1] * vx[x + 1 + (g + 1) * (y + g * z)] - ax[self] * vx[x + (g + 1) * (y + g * z)]
+                           + ay[self + sy] * vy[x + g * (y + 1 + (g + 1) * z)] - ay[self] * vy[x + g * (y + (g + 1) * z)]
+                           + az[self + sz] * vz[x + g * (y + g * (z + 1))] - az[self] * vz[x + g * (y + g * z)];
+                sum += div * div;
+                largest = std::max(largest, std::abs(div));
+                cells++;
+            }
+        }
+    }
+    return {std::sqrt(sum / std::max(cells, 1L)), largest};
+}
+
+void check_fft_projection(Init& init, ComputeHandler& computeHandler, Cfd& cfd, FftProjection& fft) {
+    buffer* velocities[] = {&cfd.vx, &cfd.vy, &cfd.vz};
+    std::vector<std::vector<float>> saved;
+    for (buffer* buf : velocities) {
+        saved.emplace_back(buf->size / sizeof(float));
+        copy_from_buffer(init, *buf, saved.back().data());
+    }
+    auto restore = [&]() {
+        for (int i = 0; i < 3; i++) copy_to_buffer(init, *velocities[i], saved[i].data());
+    };
+
+    std::pair<double, double> input = fluid_divergence(init, cfd);
+    for (kernel& pass : fft.passes) {
+        execute_kernel(init, computeHandler, pass);
+    }
+    std::pair<double, double> solved = fluid_divergence(init, cfd);
+    for (int i = 0; i < fft.sweeps; i++) {
+        execute_kernel(init, computeHandler, cfd.kernGaussSiedel);
+    }
+    std::pair<double, double> swept = fluid_divergence(init, cfd);
+    restore();
+
+    // The iterations evolve_cfd runs without the FFT projection
+    for (int i = 0; i < 10; i++) {
+        execute_kernel(init, computeHandler, cfd.kernGaussSiedel);
+    }
+    std::pair<double, double> iterated = fluid_divergence(init, cfd);
+    restore();
+
+    std::cout << "Divergence of member 0 over fluid cells (RMS, max): input " << input.first << ", " << input.second
+              << "; FFT solve " << solved.first << ", " << solved.second << "; with " << fft.sweeps << " sweeps "
+              << swept.first << ", " << swept.second << "; Gauss-Seidel " << iterated.first << ", "
+              << iterated.second << std::endl;
+}
+
+void cleanup(Init& init, Cfd& cfd, FftProjection& fft) {
+    if (fft.passes.empty()) return;
+    if (cfd.fftProjection == &fft) cfd.fftProjection = nullptr;
+    for (kernel& pass : fft.passes) {
+        cleanup(init, pass);
+    }
+    fft.passes.clear();
+    std::vector<buffer> buffers = {fft.scratchA, fft.scratchB};
+    cleanup(init, buffers);
+}
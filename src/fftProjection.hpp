@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+
+#include "cfd.hpp"
+
+// Largest radix of an FFT stage, as maxRadix in fftStage.comp. Each stage
+// runs a direct DFT of its radix, so only sizes made of small primes keep the
+// transform O(N log N).
+const int maxFftRadix = 7;
+
+// Passes of poissonFft.comp
+enum class FftMode {
+    divergence,
+    pack,
+    unpack,
+    solve,
+    gradient
+};
+
+// Projects the velocities with a direct Poisson solve instead of iterating:
+// the divergence goes through a DCT-IV along x, y and z, is divided by the
+// Laplacian's eigenvalues and transformed back into a pressure whose gradient
+// is subtracted from the faces. The DCT-IV matches the domain's boundaries,
+// a closed wall at the low face of each axis and an open outflow at the high
+// face, where the pressure is held at zero. Each DCT-IV is a complex FFT of
+// half the grid size made of Stockham stages of fftStage.comp, one per prime
+// factor (radix 4 where possible), so the grid size must be even with no
+// prime factor above maxFftRadix in its half. Solids are treated as fluid,
+// so the solve is exact only for a terrain-free box; sweeps of the
+// Gauss-Seidel kernel follow to fit the result to the terrain.
+struct FftProjection {
+    std::vector<int> radices;
+    // Two complex values per cell and member, ping-ponged by every pass
+    buffer scratchA{};
+    buffer scratchB{};
+    // Every pass of the solve, in order
+    std::vector<kernel> passes;
+    // Gauss-Seidel iterations after each solve
+    int sweeps = 2;
+};
+
+struct FftPoissonPushConstants {
+    int gridSize;
+    int mode;
+    int axis;
+};
+
+struct FftStagePushConstants {
+    int gridSize;
+    int axis;
+    int radix;
+    int span;
+    int length;
+};
+
+// Replaces the Gauss-Seidel iterations of evolve_cfd with the FFT solve and
+// `sweeps` iterations. GPU backend only; fails for an odd grid size or one
+// whose half has a prime factor above maxFftRadix, e.g. 129.
+int start_fft_projection(Init& init, ComputeHandler& computeHandler, Cfd& cfd, FftProjection& fft, int sweeps);
+
+// Projects the current velocities; called by evolve_cfd
+void run_fft_projection(Init& init, ComputeHandler& computeHandler, Cfd& cfd, FftProjection& fft);
+
+// Prints the divergence of member 0 as it is, after the FFT solve alone,
+// after the solve and its sweeps, and after evolve_cfd's Gauss-Seidel
+// iterations instead. The velocities are put back afterwards.
+void check_fft_projection(Init& init, ComputeHandler& computeHandler, Cfd& cfd, FftProjection& fft);
+
+void cleanup(Init& init, Cfd& cfd, FftProjection& fft);
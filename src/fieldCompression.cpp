@@ -0,0 +1,300 @@
+#include "fieldCompression.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+const uint32_t slabDepth = 8;
+const uint32_t groupSize = 32;
+// Codes are zigzagged residuals below 2^23; this one marks an exactly stored value
+const uint32_t escapeCode = (1u << 24) - 1;
+const int64_t maxResidual = 1 << 22;
+
+// Values are quantised to integers first, so prediction is exact integer
+// arithmetic and the decoder rebuilds bit-identical values on any machine
+int64_t quantise(float v, double step) {
+    double q = std::nearbyint(double(v) * (1.0 / step));
+    return std::fabs(q) < 1e15 ? int64_t(q) : 0;
+}
+
+float dequantise(int64_t q, double step) {
+    return float(double(q) * step);
+}
+
+// 3D Lorenzo predictor over the quantised slab, zero outside it
+int64_t lorenzo(const int64_t* q, uint32_t x, uint32_t y, uint32_t z, uint32_t nx, uint32_t ny) {
+    auto at = [&](uint32_t dx, uint32_t dy, uint32_t dz) -> int64_t {
+        if (x < dx || y < dy || z < dz) return 0;
+        return q[(x - dx) + nx * ((y - dy) + ny * (z - dz))];
+    };
+    return at(1, 0, 0) + at(0, 1, 0) + at(0, 0, 1) - at(1, 1, 0) - at(1, 0, 1) - at(0, 1, 1) + at(1, 1, 1);
+}
+
+uint32_t zigzag(int64_t r) {
+    return r < 0 ? uint32_t(-2 * r - 1) : uint32_t(2 * r);
+}
+
+int64_t unzigzag(uint32_t c) {
+    return (c & 1) ? -int64_t(c >> 1) - 1 : int64_t(c >> 1);
+}
+
+void pack_codes(const std::vector<uint32_t>& codes, std::vector<unsigned char>& out) {
+    for (size_t g = 0; g < codes.size(); g += groupSize) {
+        size_t end = std::min(codes.size(), g + groupSize);
+        uint32_t maxCode = 0;
+        for (size_t i = g; i < end; i++) maxCode = std::max(maxCode, codes[i]);
+        uint32_t width = 0;
+        while (width < 32 && (maxCode >> width) != 0) width++;
+        out.push_back(width);
+
+        uint64_t bits = 0;
+        uint32_t nBits = 0;
+        for (size_t i = g; i < g + groupSize; i++) {
+            bits |= uint64_t(i < end ? codes[i] : 0) << nBits;
+            nBits += width;
+            while (nBits >= 8) {
+                out.push_back(bits & 0xff);
+                bits >>= 8;
+                nBits -= 8;
+            }
+        }
+    }
+}
+
+// Returns the bytes read, or 0 if the groups run past size. Every group is
+// 4 * width bytes, the last one padded with zero codes.
+size_t unpack_codes(const unsigned char* data, size_t size, std::vector<uint32_t>& codes) {
+    size_t pos = 0;
+    for (size_t g = 0; g < codes.size(); g += groupSize) {
+        if (pos >= size) return 0;
+        uint32_t width = data[pos++];
+        if (width > 24 || pos + 4 * width > size) return 0;
+
+        const unsigned char* group = data + pos;
+        const uint64_t mask = (uint64_t(1) << width) - 1;
+        uint64_t bits = 0;
+        uint32_t nBits = 0;
+        for (size_t i = g; i < std::min(codes.size(), g + groupSize); i++) {
+            while (nBits < width) {
+                bits |= uint64_t(*group++) << nBits;
+                nBits += 8;
+            }
+            codes[i] = bits & mask;
+            bits >>= width;
+            nBits -= width;
+        }
+        pos += 4 * width;
+    }
+    return pos;
+}
+
+void compress_slab(const float* values, uint32_t nx, uint32_t ny, uint32_t nz, float tolerance,
+    std::vector<unsigned char>& out) {
+    const double step = 2.0 * tolerance;
+    const size_t n = size_t(nx) * ny * nz;
+    std::vector<int64_t> q(n);
+    std::vector<uint32_t> codes(n);
+    std::vector<float> exact;
+
+    for (uint32_t z = 0; z < nz; z++) {
+        for (uint32_t y = 0; y < ny; y++) {
+            for (uint32_t x = 0; x < nx; x++) {
+                size_t i = x + nx * (y + size_t(ny) * z);
+                int64_t pred = lorenzo(q.data(), x, y, z, nx, ny);
+                q[i] = quantise(values[i], step);
+                int64_t residual = q[i] - pred;
+                if (std::abs(residual) < maxResidual && std::fabs(dequantise(q[i], step) - values[i]) <= tolerance) {
+                    codes[i] = zigzag(residual);
+                } else {
+                    codes[i] = escapeCode;
+                    exact.push_back(values[i]);
+                }
+            }
+        }
+    }
+
+    pack_codes(codes, out);
+    size_t pos = out.size();
+    out.resize(pos + exact.size() * sizeof(float));
+    std::memcpy(out.data() + pos, exact.data(), exact.size() * sizeof(float));
+}
+
+int decompress_slab(const unsigned char* data, size_t size, uint32_t nx, uint32_t ny, uint32_t nz,
+    float tolerance, float* values) {
+    const double step = 2.0 * tolerance;
+    const size_t n = size_t(nx) * ny * nz;
+    std::vector<uint32_t> codes(n);
+    size_t pos = unpack_codes(data, size, codes);
+    if (pos == 0 && n > 0) return -1;
+
+    std::vector<int64_t> q(n);
+    for (uint32_t z = 0; z < nz; z++) {
+        for (uint32_t y = 0; y < ny; y++) {
+            for (uint32_t x = 0; x < nx; x++) {
+                size_t i = x + nx * (y + size_t(ny) * z);
+                if (codes[i] != escapeCode) {
+                    q[i] = lorenzo(q.data(), x, y, z, nx, ny) + unzigzag(codes[i]);
+                    values[i] = dequantise(q[i], step);
+                    continue;
+                }
+                if (pos + sizeof(float) > size) return -1;
+                std::memcpy(&values[i], data + pos, sizeof(float));
+                pos += sizeof(float);
+                q[i] = quantise(values[i], step);
+            }
+        }
+    }
+    return pos == size ? 0 : -1;
+}
+
+void field_shape(uint32_t gridSize, const std::string& name, size_t count, uint32_t shape[3]) {
+    shape[0] = name == "vx" ? gridSize + 1 : gridSize;
+    shape[1] = name == "vy" ? gridSize + 1 : gridSize;
+    shape[2] = count / (size_t(shape[0]) * shape[1]);
+    if (size_t(shape[0]) * shape[1] * shape[2] != count) {
+        shape[0] = count;
+        shape[1] = shape[2] = 1;
+    }
+}
+
+// Runs task(slab) for every slab across the hardware threads
+template <typename Task>
+void for_each_slab(uint32_t nSlabs, Task task) {
+    std::atomic<uint32_t> next{0};
+    auto worker = [&] {
+        for (uint32_t s = next++; s < nSlabs; s = next++) task(s);
+    };
+    uint32_t nThreads = std::min(nSlabs, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < nThreads; t++) threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads) thread.join();
+}
+
+int compress_field(const float* values, uint32_t nx, uint32_t ny, uint32_t nz, float tolerance,
+    std::vector<unsigned char>& out, CompressionStats* stats) {
+    if (!(tolerance > 0.0f)) {
+        std::cout << "compression tolerance must be positive\n";
+        return -1;
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    CompressedHeader header;
+    header.nx = nx;
+    header.ny = ny;
+    header.nz = nz;
+    header.tolerance = tolerance;
+    header.slabDepth = slabDepth;
+    header.nSlabs = (nz + slabDepth - 1) / slabDepth;
+
+    const size_t sliceSize = size_t(nx) * ny;
+    std::vector<std::vector<unsigned char>> slabs(header.nSlabs);
+    for_each_slab(header.nSlabs, [&](uint32_t s) {
+        uint32_t z0 = s * slabDepth;
+        compress_slab(values + z0 * sliceSize, nx, ny, std::min(slabDepth, nz - z0), tolerance, slabs[s]);
+    });
+
+    std::vector<uint64_t> slabSizes(header.nSlabs);
+    size_t total = sizeof(header) + slabSizes.size() * sizeof(uint64_t);
+    for (uint32_t s = 0; s < header.nSlabs; s++) {
+        slabSizes[s] = slabs[s].size();
+        total += slabs[s].size();
+    }
+    out.resize(total);
+    unsigned char* p = out.data();
+    std::memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    std::memcpy(p, slabSizes.data(), slabSizes.size() * sizeof(uint64_t));
+    p += slabSizes.size() * sizeof(uint64_t);
+    for (const auto& slab : slabs) {
+        std::memcpy(p, slab.data(), slab.size());
+        p += slab.size();
+    }
+
+    if (stats) {
+        stats->rawBytes = sliceSize * nz * sizeof(float);
+        stats->compressedBytes = out.size();
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return 0;
+}
+
+int decompress_field(const unsigned char* data, size_t size, std::vector<float>& values, CompressionStats* stats) {
+    auto start = std::chrono::steady_clock::now();
+    CompressedHeader header;
+    if (size < sizeof(header)) return -1;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, CompressedHeader().magic, 4) != 0 || header.version != 1 ||
+        header.slabDepth == 0 || header.nSlabs != (header.nz + header.slabDepth - 1) / header.slabDepth ||
+        size < sizeof(header) + header.nSlabs * sizeof(uint64_t)) {
+        return -1;
+    }
+
+    std::vector<uint64_t> slabSizes(header.nSlabs);
+    std::memcpy(slabSizes.data(), data + sizeof(header), slabSizes.size() * sizeof(uint64_t));
+    std::vector<size_t> slabOffsets(header.nSlabs);
+    size_t pos = sizeof(header) + slabSizes.size() * sizeof(uint64_t);
+    for (uint32_t s = 0; s < header.nSlabs; s++) {
+        slabOffsets[s] = pos;
+        if (slabSizes[s] > size - pos) return -1;
+        pos += slabSizes[s];
+    }
+
+    const size_t sliceSize = size_t(header.nx) * header.ny;
+    values.resize(sliceSize * header.nz);
+    std::atomic<bool> damaged{false};
+    for_each_slab(header.nSlabs, [&](uint32_t s) {
+        uint32_t z0 = s * header.slabDepth;
+        uint32_t depth = std::min(header.slabDepth, header.nz - z0);
+        if (0 != decompress_slab(data + slabOffsets[s], slabSizes[s], header.nx, header.ny, depth,
+                header.tolerance, values.data() + z0 * sliceSize)) {
+            damaged = true;
+        }
+    });
+    if (damaged) return -1;
+
+    if (stats) {
+        stats->rawBytes = values.size() * sizeof(float);
+        stats->compressedBytes = size;
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return 0;
+}
+
+void report_compression(const std::string& name, const CompressionStats& stats) {
+    const double mb = 1 << 20;
+    std::cout << name << ": " << stats.rawBytes / mb << " MB -> " << stats.compressedBytes / mb << " MB ("
+              << double(stats.rawBytes) / std::max<size_t>(1, stats.compressedBytes) << "x), "
+              << stats.rawBytes / mb / std::max(stats.seconds, 1e-9) << " MB/s\n";
+}
+
+int decompress_file(const std::string& in, const std::string& out) {
+    std::ifstream inFile(in, std::ios::binary);
+    if (!inFile.is_open()) {
+        std::cout << "failed to open " << in << "\n";
+        return -1;
+    }
+    std::vector<unsigned char> data((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+
+    std::vector<float> values;
+    CompressionStats stats;
+    if (0 != decompress_field(data.data(), data.size(), values, &stats)) {
+        std::cout << in << " is not a complete compressed field\n";
+        return -1;
+    }
+
+    std::ofstream outFile(out, std::ios::binary);
+    outFile.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+    if (!outFile.good()) {
+        std::cout << "failed to write " << out << "\n";
+        return -1;
+    }
+    report_compression(in, stats);
+    return 0;
+}
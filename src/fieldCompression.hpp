@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Error-bounded lossy compression of a nx x ny x nz float field, x fastest.
+// Each value is predicted from its already decoded neighbours with the 3D
+// Lorenzo predictor and the residual is quantised to a multiple of
+// 2 * tolerance, so every decoded value is within tolerance of the original.
+// Values the quantiser can't bound (outliers, NaN, inf) are stored exactly.
+//
+// The field is cut into slabs of slabDepth z-slices that are predicted and
+// coded independently, so slabs compress and decompress in parallel. A file
+// is a CompressedHeader, nSlabs uint64 slab sizes, then the slabs. A slab is
+// groups of 32 quantised codes, each a width byte then 32 codes of that many
+// bits, followed by the exactly stored values.
+struct CompressedHeader {
+    char magic[4] = {'T', 'L', 'Z', 'F'};
+    uint32_t version = 1;
+    uint32_t nx = 0;
+    uint32_t ny = 0;
+    uint32_t nz = 0;
+    float tolerance = 0.0f;
+    uint32_t slabDepth = 0;
+    uint32_t nSlabs = 0;
+};
+static_assert(sizeof(CompressedHeader) == 32, "compressed field header must stay 32 bytes");
+
+// Absolute tolerance by field name, e.g. "vx" or "density"
+using FieldTolerances = std::map<std::string, float>;
+
+struct CompressionStats {
+    size_t rawBytes = 0;
+    size_t compressedBytes = 0;
+    double seconds = 0.0;
+};
+
+// Extent of count values of the solver field name ("vx", "density", ...) on
+// a gridSize grid: one member's x and y, with members stacked along z. Falls
+// back to count x 1 x 1 when count isn't whole slices.
+void field_shape(uint32_t gridSize, const std::string& name, size_t count, uint32_t shape[3]);
+
+// Returns -1 if tolerance isn't positive
+int compress_field(const float* values, uint32_t nx, uint32_t ny, uint32_t nz, float tolerance,
+    std::vector<unsigned char>& out, CompressionStats* stats = nullptr);
+
+// Returns -1 if data isn't a complete compressed field
+int decompress_field(const unsigned char* data, size_t size, std::vector<float>& values,
+    CompressionStats* stats = nullptr);
+
+// Prints the ratio and throughput, e.g. "vx: 9.3 MB -> 0.6 MB (15.1x), 840 MB/s"
+void report_compression(const std::string& name, const CompressionStats& stats);
+
+// Decompresses a file written by compress_field into raw floats
+int decompress_file(const std::string& in, const std::string& out);
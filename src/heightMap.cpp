@@ -0,0 +1,467 @@
+#include "heightMap.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+int open_file_view(const std::string& filename, FileView& view) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    view.size = st.st_size;
+    if (view.size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    void* mapping = mmap(nullptr, view.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return -1;
+    view.mapping = mapping;
+    view.data = static_cast<const char*>(mapping);
+    return 0;
+}
+
+void close_file_view(FileView& view) {
+    if (view.mapping != nullptr) munmap(view.mapping, view.size);
+    view = FileView();
+}
+#else
+int open_file_view(const std::string& filename, FileView& view) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) return -1;
+    view.size = file.tellg();
+    file.seekg(0);
+    view.copy.resize(view.size);
+    file.read(view.copy.data(), view.size);
+    view.data = view.copy.data();
+    return file ? 0 : -1;
+}
+
+void close_file_view(FileView& view) {
+    view = FileView();
+}
+#endif
+
+size_t sample_size(HeightType dtype) {
+    switch (dtype) {
+        case HeightType::f32: return 4;
+        case HeightType::i16: return 2;
+        case HeightType::u16: return 2;
+    }
+    return 0;
+}
+
+bool has_magic(const HeightMapHeader& header) {
+    return std::memcmp(header.magic, HeightMapHeader().magic, sizeof(header.magic)) == 0;
+}
+
+int check_header(const HeightMapHeader& header, size_t fileSize, const std::string& filename) {
+    if (header.version != 1 || sample_size(header.dtype) == 0) {
+        std::cout << filename << ": unsupported heightmap version " << header.version << " or type\n";
+        return -1;
+    }
+    if (sizeof(HeightMapHeader) + size_t(header.cols) * header.rows * sample_size(header.dtype) > fileSize) {
+        std::cout << filename << ": heightmap is truncated\n";
+        return -1;
+    }
+    return 0;
+}
+
+// Takes over the view if it holds a binary heightmap. Returns 1 if it doesn't.
+int map_binary(const std::string& filename, FileView& view, HeightMap& map) {
+    if (view.size < sizeof(HeightMapHeader)) return 1;
+    std::memcpy(&map.header, view.data, sizeof(HeightMapHeader));
+    if (!has_magic(map.header)) return 1;
+    if (0 != check_header(map.header, view.size, filename)) return -1;
+
+    if (view.mapping != nullptr) {
+        map.mapping = view.mapping;
+        map.mappingSize = view.size;
+        map.samples = view.data + sizeof(HeightMapHeader);
+        view = FileView();
+        return 0;
+    }
+
+    size_t bytes = size_t(map.header.cols) * map.header.rows * sample_size(map.header.dtype);
+    map.owned.resize((bytes + sizeof(float) - 1) / sizeof(float));
+    std::memcpy(map.owned.data(), view.data + sizeof(HeightMapHeader), bytes);
+    map.samples = map.owned.data();
+    return 0;
+}
+
+bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+template <class T>
+const char* parse_number(const char* p, const char* end, T& value) {
+#if defined(__cpp_lib_to_chars)
+    auto res = std::from_chars(p, end, value);
+    return res.ec == std::errc() ? res.ptr : nullptr;
+#else
+    // No floating point from_chars: strtod on a terminated copy of the token
+    char token[64];
+    size_t n = 0;
+    while (p + n < end && !is_space(p[n]) && n < sizeof(token) - 1) n++;
+    std::memcpy(token, p, n);
+    token[n] = '\0';
+    char* parsed;
+    value = T(std::strtod(token, &parsed));
+    return parsed == token ? nullptr : p + (parsed - token);
+#endif
+}
+
+// Values in [begin, end)
+size_t count_values(const char* begin, const char* end) {
+    size_t n = 0;
+    bool inValue = false;
+    for (const char* p = begin; p < end; p++) {
+        bool space = is_space(*p);
+        n += !space && !inValue;
+        inValue = !space;
+    }
+    return n;
+}
+
+// Parses [begin, end) into out. Returns nullptr on success, otherwise where parsing failed.
+const char* parse_values(const char* begin, const char* end, float* out) {
+    const char* p = begin;
+    while (true) {
+        while (p < end && is_space(*p)) p++;
+        if (p == end) return nullptr;
+        const char* next = parse_number(p, end, *out);
+        if (next == nullptr || (next < end && !is_space(*next))) return p;
+        out++;
+        p = next;
+    }
+}
+
+const char* line_end(const char* p, const char* end) {
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline == nullptr ? end : newline + 1;
+}
+
+// Reads ESRI ASCII grid header lines ("ncols 100" etc.) at the start of the
+// file, leaving pos at the first line of values. Returns -1 on an unknown key.
+int parse_esri_header(const char* data, size_t size, size_t& pos, HeightMapHeader& header, bool& esri) {
+    const char* end = data + size;
+    const char* p = data;
+    esri = false;
+    double xll = 0.0, yll = 0.0, cellSize = 1.0;
+    bool centre = false;
+
+    while (p < end) {
+        const char* next = line_end(p, end);
+        const char* q = p;
+        while (q < next && is_space(*q)) q++;
+        if (q == next) {
+            p = next;
+            continue;
+        }
+        // Values, including a bare file that starts with nan or inf
+        double probe;
+        if (!std::isalpha(static_cast<unsigned char>(*q)) || parse_number(q, next, probe) != nullptr) break;
+
+        const char* keyEnd = q;
+        while (keyEnd < next && !is_space(*keyEnd)) keyEnd++;
+        std::string key(q, keyEnd);
+        std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return std::tolower(c); });
+        while (keyEnd < next && is_space(*keyEnd)) keyEnd++;
+
+        double value;
+        if (parse_number(keyEnd, next, value) == nullptr) {
+            std::cout << "bad value for header key " << key << "\n";
+            return -1;
+        }
+
+        if (key == "ncols") header.cols = uint32_t(value);
+        else if (key == "nrows") header.rows = uint32_t(value);
+        else if (key == "xllcorner") xll = value;
+        else if (key == "yllcorner") yll = value;
+        else if (key == "xllcenter") xll = value, centre = true;
+        else if (key == "yllcenter") yll = value, centre = true;
+        else if (key == "cellsize") cellSize = value;
+        else if (key == "nodata_value") header.noData = value;
+        else {
+            std::cout << "unknown header key " << key << "\n";
+            return -1;
+        }
+        esri = true;
+        p = next;
+    }
+
+    // Origin is the centre of the lower left cell
+    header.spacingX = header.spacingY = cellSize;
+    header.originX = centre ? xll : xll + 0.5 * cellSize;
+    header.originY = centre ? yll : yll + 0.5 * cellSize;
+    pos = p - data;
+    return 0;
+}
+
+// Swaps row r with row rows - 1 - r, so the last row read becomes row 0
+void reverse_rows(std::vector<float>& samples, size_t cols, size_t rows) {
+    for (size_t r = 0; r < rows / 2; r++) {
+        auto top = samples.begin() + r * cols;
+        std::swap_ranges(top, top + cols, samples.begin() + (rows - 1 - r) * cols);
+    }
+}
+
+// Parses values in line-aligned chunks, one per thread, straight into out.
+// With rowValues set, every non-empty line must hold exactly that many values.
+int parse_parallel(const char* begin, const char* end, int nThreads, std::vector<float>& out, size_t rowValues = 0) {
+    const size_t minChunk = 1 << 20;
+    int nChunks = std::max<size_t>(1, std::min<size_t>(nThreads, (end - begin) / minChunk));
+
+    std::vector<const char*> bounds(nChunks + 1, end);
+    bounds[0] = begin;
+    for (int i = 1; i < nChunks; i++) {
+        const char* p = begin + (end - begin) * i / nChunks;
+        bounds[i] = std::max(bounds[i - 1], line_end(p, end));
+    }
+
+    std::vector<size_t> offsets(nChunks + 1, 0);
+    std::vector<const char*> failed(nChunks, nullptr);
+    std::vector<size_t> ragged(nChunks, 0);
+    auto run = [&](const std::function<void(int)>& job) {
+        std::vector<std::thread> threads;
+        for (int i = 1; i < nChunks; i++) threads.emplace_back(job, i);
+        job(0);
+        for (auto& t : threads) t.join();
+    };
+
+    run([&](int i) {
+        if (rowValues == 0) {
+            offsets[i + 1] = count_values(bounds[i], bounds[i + 1]);
+            return;
+        }
+        for (const char* p = bounds[i]; p < bounds[i + 1];) {
+            const char* next = line_end(p, bounds[i + 1]);
+            size_t n = count_values(p, next);
+            if (n != 0 && n != rowValues && ragged[i] == 0) ragged[i] = n;
+            offsets[i + 1] += n;
+            p = next;
+        }
+    });
+    for (size_t n : ragged) {
+        if (n != 0) {
+            std::cout << "terrain row with " << n << " values, the first row has " << rowValues << "\n";
+            return -1;
+        }
+    }
+    for (int i = 0; i < nChunks; i++) offsets[i + 1] += offsets[i];
+
+    out.resize(offsets[nChunks]);
+    run([&](int i) { failed[i] = parse_values(bounds[i], bounds[i + 1], out.data() + offsets[i]); });
+
+    for (const char* p : failed) {
+        if (p != nullptr) {
+            const char* tokenEnd = p;
+            while (tokenEnd < end && !is_space(*tokenEnd) && tokenEnd - p < 32) tokenEnd++;
+            std::cout << "bad value \"" << std::string(p, tokenEnd) << "\" in terrain file\n";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Values in the first non-empty line from p
+size_t first_line_values(const char* p, const char* end) {
+    while (p < end) {
+        const char* next = line_end(p, end);
+        size_t n = count_values(p, next);
+        if (n > 0) return n;
+        p = next;
+    }
+    return 0;
+}
+
+// "x y z" points on a regular grid, x varying fastest. Keeps z and derives the
+// dimensions, spacing and origin from the x and y of the first rows.
+int read_xyz(const FileView& view, int nThreads, HeightMap& map) {
+    const char* begin = view.data;
+    const char* end = view.data + view.size;
+    if (0 != parse_parallel(begin, end, nThreads, map.owned)) return -1;
+    if (map.owned.size() % 3 != 0 || map.owned.empty()) {
+        std::cout << "xyz file does not hold whole points\n";
+        return -1;
+    }
+    size_t points = map.owned.size() / 3;
+
+    // Coordinates again in double, a float can't resolve projected eastings
+    double x0 = 0.0, y0 = 0.0, x1 = 0.0, yNext = 0.0;
+    size_t cols = 0;
+    for (const char* p = begin; p < end;) {
+        const char* next = line_end(p, end);
+        while (p < next && is_space(*p)) p++;
+        if (p == next) continue;
+
+        double x, y;
+        const char* q = parse_number(p, next, x);
+        while (q != nullptr && q < next && is_space(*q)) q++;
+        if (q == nullptr || parse_number(q, next, y) == nullptr) return -1;
+
+        if (cols == 0) x0 = x, y0 = y;
+        if (cols == 1) x1 = x;
+        if (y != y0) {
+            yNext = y;
+            break;
+        }
+        cols++;
+        p = next;
+    }
+    if (points % cols != 0) {
+        std::cout << "xyz points do not form a grid of " << cols << " columns\n";
+        return -1;
+    }
+
+    for (size_t i = 0; i < points; i++) map.owned[i] = map.owned[3 * i + 2];
+    map.owned.resize(points);
+
+    map.header.cols = cols;
+    map.header.rows = points / cols;
+    map.header.spacingX = cols > 1 ? std::abs(x1 - x0) : 1.0;
+    map.header.spacingY = map.header.rows > 1 ? std::abs(yNext - y0) : map.header.spacingX;
+    map.header.originX = x0;
+    map.header.originY = y0;
+
+    // Row 0 is the lowest y. Exports that list y descending (north first) are
+    // flipped, and the origin moves to the last row.
+    if (map.header.rows > 1 && yNext < y0) {
+        reverse_rows(map.owned, cols, map.header.rows);
+        map.header.originY = y0 - (map.header.rows - 1) * map.header.spacingY;
+    }
+    return 0;
+}
+
+int read_text(const std::string& filename, const FileView& view, int nThreads, HeightMap& map) {
+    if (nThreads <= 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    map.header = HeightMapHeader();
+    map.owned.clear();
+
+    size_t ext = filename.rfind('.');
+    bool xyz = ext != std::string::npos && (filename.substr(ext) == ".xyz" || filename.substr(ext) == ".XYZ");
+    if (xyz) {
+        if (0 != read_xyz(view, nThreads, map)) return -1;
+        map.samples = map.owned.data();
+        return 0;
+    }
+
+    size_t pos = 0;
+    bool esri;
+    if (0 != parse_esri_header(view.data, view.size, pos, map.header, esri)) return -1;
+
+    const char* begin = view.data + pos;
+    const char* end = view.data + view.size;
+
+    // Bare format: the first row sets the width and every row must match it.
+    // With no header the origin is the first sample itself.
+    if (!esri) map.header.cols = first_line_values(begin, end);
+    if (0 != parse_parallel(begin, end, nThreads, map.owned, esri ? 0 : map.header.cols)) return -1;
+
+    if (!esri) {
+        map.header.rows = map.header.cols > 0 ? map.owned.size() / map.header.cols : 0;
+        map.header.originX = 0.0;
+        map.header.originY = 0.0;
+    }
+    if (size_t(map.header.cols) * map.header.rows != map.owned.size()) {
+        std::cout << filename << ": " << map.owned.size() << " values do not fill " << map.header.cols << " x "
+                  << map.header.rows << " rows\n";
+        return -1;
+    }
+    // ESRI grids list the northern row first, but the origin is the lower left
+    if (esri) reverse_rows(map.owned, map.header.cols, map.header.rows);
+
+    map.samples = map.owned.data();
+    return 0;
+}
+
+int read_text_height_map(const std::string& filename, HeightMap& map, int nThreads) {
+    FileView view;
+    if (0 != open_file_view(filename, view)) {
+        std::cout << "failed to open terrain file " << filename << "\n";
+        return -1;
+    }
+    int res = read_text(filename, view, nThreads, map);
+    close_file_view(view);
+    return res;
+}
+
+int load_height_map(const std::string& filename, HeightMap& map, int nThreads) {
+    close_height_map(map);
+
+    FileView view;
+    if (0 != open_file_view(filename, view)) {
+        std::cout << "failed to open terrain file " << filename << "\n";
+        return -1;
+    }
+
+    int res = map_binary(filename, view, map);
+    if (res == 1) res = read_text(filename, view, nThreads, map);
+    close_file_view(view);
+    return res;
+}
+
+int write_height_map(const std::string& filename, const HeightMap& map) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "failed to open " << filename << "\n";
+        return -1;
+    }
+
+    size_t bytes = size_t(map.header.cols) * map.header.rows * sample_size(map.header.dtype);
+    file.write(reinterpret_cast<const char*>(&map.header), sizeof(HeightMapHeader));
+    file.write(static_cast<const char*>(map.samples), bytes);
+    return file.good() ? 0 : -1;
+}
+
+int convert_height_map(const std::string& textFile, const std::string& binaryFile) {
+    HeightMap map;
+    if (0 != read_text_height_map(textFile, map)) return -1;
+    int res = write_height_map(binaryFile, map);
+    if (res == 0) std::cout << "Wrote " << map.header.cols << " x " << map.header.rows << " heightmap to " << binaryFile << "\n";
+    close_height_map(map);
+    return res;
+}
+
+float height_at(const HeightMap& map, size_t col, size_t row) {
+    size_t i = col + row * map.header.cols;
+    double value = 0.0;
+    switch (map.header.dtype) {
+        case HeightType::f32: value = static_cast<const float*>(map.samples)[i]; break;
+        case HeightType::i16: value = static_cast<const int16_t*>(map.samples)[i]; break;
+        case HeightType::u16: value = static_cast<const uint16_t*>(map.samples)[i]; break;
+    }
+    return value == map.header.noData ? 0.0f : float(value);
+}
+
+void close_height_map(HeightMap& map) {
+#if defined(__unix__) || defined(__APPLE__)
+    if (map.mapping != nullptr) munmap(map.mapping, map.mappingSize);
+#endif
+    map.mapping = nullptr;
+    map.mappingSize = 0;
+    map.samples = nullptr;
+    map.owned.clear();
+}
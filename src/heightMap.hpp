@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Binary heightmap file: a 64 byte little-endian header followed by
+// rows x cols samples in row-major order, so row r, column c is sample
+// c + r * cols. Columns run along x and rows along y.
+enum class HeightType : uint32_t {
+    f32 = 0,
+    i16 = 1,
+    u16 = 2
+};
+
+struct HeightMapHeader {
+    char magic[4] = {'T', 'H', 'M', 'P'};
+    uint32_t version = 1;
+    uint32_t cols = 0;
+    uint32_t rows = 0;
+    HeightType dtype = HeightType::f32;
+    uint32_t reserved = 0;
+    double spacingX = 1.0;
+    double spacingY = 1.0;
+    double originX = 0.0;
+    double originY = 0.0;
+    // Samples equal to this have no data; NaN when every sample is valid
+    double noData = std::numeric_limits<double>::quiet_NaN();
+};
+static_assert(sizeof(HeightMapHeader) == 64, "heightmap header must stay 64 bytes");
+
+// Samples either mapped straight from a binary file or owned in memory
+struct HeightMap {
+    HeightMapHeader header;
+    const void* samples = nullptr;
+
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    std::vector<float> owned;
+};
+
+// A whole file in memory, mapped where the platform allows it
+struct FileView {
+    const char* data = nullptr;
+    size_t size = 0;
+    void* mapping = nullptr;
+    std::vector<char> copy;
+};
+
+int open_file_view(const std::string& filename, FileView& view);
+void close_file_view(FileView& view);
+
+// Opens a binary heightmap, or parses a text one if the file doesn't start with
+// the magic. Returns -1 on failure.
+int load_height_map(const std::string& filename, HeightMap& map, int nThreads = 0);
+
+// Text heightmaps, parsed on nThreads threads (0 for every core):
+//  - whitespace separated values, one row per line
+//  - ESRI ASCII grids: ncols, nrows, xllcorner/xllcenter, yllcorner/yllcenter,
+//    cellsize and NODATA_value header lines before the rows, northern row
+//    first; the rows are flipped so row 0 is the southern one
+//  - .xyz files of "x y z" points on a regular grid with x varying fastest;
+//    y may ascend or descend
+int read_text_height_map(const std::string& filename, HeightMap& map, int nThreads = 0);
+
+int write_height_map(const std::string& filename, const HeightMap& map);
+
+// Converts a text heightmap to the binary format, as f32 samples
+int convert_height_map(const std::string& textFile, const std::string& binaryFile);
+
+// Height at (col, row) as a float; no-data samples read as 0
+float height_at(const HeightMap& map, size_t col, size_t row);
+
+void close_height_map(HeightMap& map);
@@ -1,10 +1,24 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+
 #include "vkHelper.hpp"
 #include "shaderHelper.hpp"
 #include "cfd.hpp"
 #include "plainRenderer.hpp"
+#include "sweep.hpp"
+#include "readback.hpp"
+#include "checkpoint.hpp"
+#include "vtkExport.hpp"
+#include "probes.hpp"
+#include "statistics.hpp"
+#include "diagnostics.hpp"
+#include "fftProjection.hpp"
+#include "heightMap.hpp"
 
 #ifdef NDEBUG
 const bool enableValidationLayers = false;
@@ -38,15 +52,585 @@ void print_matrix(const std::vector<float>& mat, size_t rows) {
     }
 }
 
-int main() {
+double run_steps(Init& init, ComputeHandler& compute_handler, Cfd& cfd, int steps) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < steps; i++) {
+        evolve_cfd(init, compute_handler, cfd);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << steps << " steps in " << seconds << " s (" << steps / seconds << " steps/s)\n";
+    return steps / seconds;
+}
+
+// CPU backend throughput from 1 thread up to every core, doubling each time.
+// Tiles are tuned once with all cores and reused for the smaller counts.
+void run_scaling(Init& init, ComputeHandler& compute_handler, int gridSize, const std::string& terrainFile, int steps) {
+    const int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> counts;
+    for (int n = 1; n < maxThreads; n *= 2) counts.push_back(n);
+    counts.push_back(maxThreads);
+
+    std::vector<double> rates(counts.size());
+    int tileY = 0, tileZ = 0, tileSweeps = 0;
+    for (int i = int(counts.size()) - 1; i >= 0; i--) {
+        Cfd cfd;
+        cfd.backend = Backend::cpu;
+        cfd.cpu.nThreads = counts[i];
+        init_cfd(init, compute_handler, cfd, gridSize);
+        load_terrain(init, compute_handler, cfd, terrainFile);
+
+        if (i == int(counts.size()) - 1) {
+            tune_gauss_siedel(cfd.cpu);
+            tileY = cfd.cpu.tileY, tileZ = cfd.cpu.tileZ, tileSweeps = cfd.cpu.tileSweeps;
+        } else {
+            cfd.cpu.tileY = tileY, cfd.cpu.tileZ = tileZ, cfd.cpu.tileSweeps = tileSweeps;
+        }
+
+        std::cout << counts[i] << " threads: ";
+        rates[i] = run_steps(init, compute_handler, cfd, steps);
+        cleanup(init, cfd);
+    }
+
+    std::cout << "threads, steps/s, speedup, efficiency\n";
+    for (size_t i = 0; i < counts.size(); i++) {
+        double speedup = rates[i] / rates[0];
+        std::cout << counts[i] << ", " << rates[i] << ", " << speedup << ", " << speedup / counts[i] << "\n";
+    }
+}
+
+// Cell-centred velocity of member 0, averaged over blocks of scale^3 cells
+std::vector<float> cell_velocity(Init& init, Cfd& cfd, int scale) {
+    std::vector<float> vx, vy, vz, density;
+    read_member_fields(init, cfd, 0, vx, vy, vz, density);
+    const int g = cfd.gridSize;
+    const int n = g / scale;
+    std::vector<float> cells(3 * n * n * n, 0.0f);
+    for (int z = 0; z < n * scale; z++) {
+        for (int y = 0; y < n * scale; y++) {
+            for (int x = 0; x < n * scale; x++) {
+                float* cell = &cells[3 * (x / scale + n * (y / scale + n * (z / scale)))];
+                cell[0] += 0.5f * (vx[x + (g + 1) * (y + g * z)] + vx[x + 1 + (g + 1) * (y + g * z)]);
+                cell[1] += 0.5f * (vy[x + g * (y + (g + 1) * z)] + vy[x + g * (y + 1 + (g + 1) * z)]);
+                cell[2] += 0.5f * (vz[x + g * (y + g * z)] + vz[x + g * (y + g * (z + 1))]);
+            }
+        }
+    }
+    for (float& v : cells) v /= scale * scale * scale;
+    return cells;
+}
+
+// Semi-Lagrangian against MacCormack advection at half gridSize and at twice
+// that, each grid running the steps that cover the same flow time. Accuracy
+// is the RMS velocity difference from a reference that isn't one of the
+// measured runs: MacCormack on a grid twice the fine one. The difference is
+// taken on the coarse grid and relative to the reference's RMS speed. All
+// three grids are even, which the checkerboard Gauss-Seidel colouring handles.
+void run_advection_benchmark(Init& init, ComputeHandler& compute_handler, int gridSize, const std::string& terrainFile,
+    int steps) {
+    const int coarse = gridSize / 2;
+    const int fine = 2 * coarse;
+    struct Run {
+        int gridSize;
+        bool maccormack;
+        double rate = 0.0;
+        std::vector<float> velocity;
+    };
+    auto run_scheme = [&](Run& run) {
+        Cfd cfd;
+        cfd.maccormack = run.maccormack;
+        init_cfd(init, compute_handler, cfd, run.gridSize);
+        load_terrain(init, compute_handler, cfd, terrainFile);
+        std::cout << run.gridSize << (run.maccormack ? " MacCormack: " : " semi-Lagrangian: ");
+        run.rate = run_steps(init, compute_handler, cfd, steps * run.gridSize / coarse);
+        run.velocity = cell_velocity(init, cfd, run.gridSize / coarse);
+        cleanup(init, cfd);
+    };
+    std::vector<Run> runs = {{coarse, false}, {coarse, true}, {fine, false}, {fine, true}};
+    for (Run& run : runs) run_scheme(run);
+
+    Run referenceRun{2 * fine, true};
+    std::cout << "reference, ";
+    run_scheme(referenceRun);
+    const std::vector<float>& reference = referenceRun.velocity;
+    double norm = 0.0;
+    for (float v : reference) norm += double(v) * v;
+    norm = std::sqrt(norm / reference.size());
+
+    std::cout << "grid, scheme, steps/s, ms per coarse step, relative error\n";
+    for (const Run& run : runs) {
+        double error = 0.0;
+        for (size_t i = 0; i < reference.size(); i++) {
+            double d = run.velocity[i] - reference[i];
+            error += d * d;
+        }
+        error = std::sqrt(error / reference.size()) / std::max(norm, 1e-30);
+        std::cout << run.gridSize << ", " << (run.maccormack ? "maccormack" : "semi-lagrangian") << ", " << run.rate
+                  << ", " << 1000.0 * run.gridSize / coarse / run.rate << ", " << error << "\n";
+    }
+}
+
+// Writes a text heightmap of about megabytes MB and times parsing it with 1
+// thread up to every core
+int run_parse_benchmark(int megabytes) {
+    std::string filename = (std::filesystem::temp_directory_path() / "thermal_cfd_parse_bench.txt").string();
+    const int cols = 4096;
+
+    // A handful of distinct rows repeated, so writing doesn't dominate
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> height(0.0f, 1.0f);
+    std::vector<std::string> rows(64);
+    for (auto& row : rows) {
+        char value[16];
+        for (int c = 0; c < cols; c++) {
+            int n = std::snprintf(value, sizeof(value), c + 1 < cols ? "%.4f " : "%.4f\n", height(rng));
+            row.append(value, n);
+        }
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    size_t bytes = 0, nRows = 0;
+    while (bytes < size_t(megabytes) << 20) {
+        const std::string& row = rows[nRows++ % rows.size()];
+        file.write(row.data(), row.size());
+        bytes += row.size();
+    }
+    file.close();
+    if (!file) {
+        std::cout << "failed to write " << filename << "\n";
+        return -1;
+    }
+    std::cout << "Parsing " << bytes / double(1 << 20) << " MB, " << cols << " x " << nRows << " values\n";
+
+    const int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> counts;
+    for (int n = 1; n < maxThreads; n *= 2) counts.push_back(n);
+    counts.push_back(maxThreads);
+
+    std::cout << "threads, seconds, MB/s\n";
+    for (int n : counts) {
+        HeightMap map;
+        auto start = std::chrono::steady_clock::now();
+        int res = read_text_height_map(filename, map, n);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        close_height_map(map);
+        if (res != 0) return -1;
+        std::cout << n << ", " << seconds << ", " << bytes / double(1 << 20) / seconds << "\n";
+    }
+
+    std::filesystem::remove(filename);
+    return 0;
+}
+
+// Boundaries from the terrain, or the whole state from a checkpoint, which
+// skips voxelisation and the spin-up from the initial conditions
+int load_state(Init& init, ComputeHandler& compute_handler, Cfd& cfd, const std::string& terrainFile,
+    const std::string& restartFile) {
+    if (restartFile.empty()) {
+        load_terrain(init, compute_handler, cfd, terrainFile);
+        return 0;
+    }
+    return restore_checkpoint(init, cfd, restartFile);
+}
+
+// A field written to disk every `every` steps by --record
+struct Recording {
+    std::string name;
+    Field field;
+    int every;
+    // Written with compress_field when positive
+    float tolerance = 0.0f;
+};
+
+int parse_field(const std::string& name, Field& field) {
+    const std::pair<const char*, Field> fields[] = {
+        {"vx", Field::vx}, {"vy", Field::vy}, {"vz", Field::vz}, {"density", Field::density}, {"pressure", Field::pressure},
+        {"temperature", Field::temperature}};
+    for (const auto& f : fields) {
+        if (name == f.first) {
+            field = f.second;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Subscribes every member to each recording, then starts readback for these
+// and any other subscriptions. The readback thread writes
+// <dir>/<field>_<member>_<step>.raw, or .tlz when compressed, while the
+// solver carries on.
+int start_recording(Init& init, ComputeHandler& compute_handler, Cfd& cfd, Readback& readback,
+    const std::vector<Recording>& recordings, const std::string& dir) {
+    for (const Recording& rec : recordings) {
+        for (int m = 0; m < cfd.members; m++) {
+            std::string prefix = dir + "/" + rec.name + "_" + std::to_string(m) + "_";
+            auto write = [prefix, rec, gridSize = cfd.gridSize](long step, int, const std::vector<float>& values) {
+                std::string filename = prefix + std::to_string(step) + (rec.tolerance > 0.0f ? ".tlz" : ".raw");
+                std::ofstream file(filename, std::ios::binary);
+                if (rec.tolerance > 0.0f) {
+                    uint32_t shape[3];
+                    field_shape(gridSize, rec.name, values.size(), shape);
+                    std::vector<unsigned char> compressed;
+                    CompressionStats stats;
+                    compress_field(values.data(), shape[0], shape[1], shape[2], rec.tolerance, compressed, &stats);
+                    file.write(reinterpret_cast<const char*>(compressed.data()), compressed.size());
+                    report_compression(filename, stats);
+                } else {
+                    file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+                }
+                if (!file.good()) std::cout << "failed to write " << filename << "\n";
+            };
+            if (0 != subscribe_field(readback, cfd, rec.field, m, rec.every, write)) return -1;
+        }
+    }
+    return start_readback(init, compute_handler, readback, cfd);
+}
+
+// Samples the probes in probeFile after every step and appends them to
+// <dir>/probes.csv, one line per step, member and probe, as the ring drains
+int start_probe_output(Init& init, ComputeHandler& compute_handler, Cfd& cfd, Readback& readback, Probes& probes,
+    const std::string& probeFile, int ringSteps, const std::string& dir) {
+    if (probeFile.empty()) return 0;
+    std::vector<Probe> points;
+    if (0 != load_probes(probeFile, points)) return -1;
+
+    auto csv = std::make_shared<std::ofstream>(dir + "/probes.csv");
+    if (!csv->is_open()) {
+        std::cout << "failed to open " << dir << "/probes.csv\n";
+        return -1;
+    }
+    *csv << "step,member,probe,vx,vy,vz\n";
+    const int members = cfd.members, count = points.size();
+    auto write = [csv, members, count](long step, const std::vector<float>& velocities) {
+        for (int m = 0; m < members; m++) {
+            for (int p = 0; p < count; p++) {
+                const float* v = &velocities[3 * (m * count + p)];
+                *csv << step << "," << m << "," << p << "," << v[0] << "," << v[1] << "," << v[2] << "\n";
+            }
+        }
+    };
+    std::cout << points.size() << " probes, drained every " << ringSteps << " steps\n";
+    return start_probes(init, compute_handler, readback, cfd, probes, points, ringSteps, write);
+}
+
+// Appends every step's diagnostics to <dir>/diagnostics.csv and warns the
+// first time a member's energy or speed stops being finite. Without output
+// the reduction still runs when cfd.cfl needs it for the adaptive timestep.
+int start_diagnostics_output(Init& init, ComputeHandler& compute_handler, Cfd& cfd, Readback& readback,
+    Diagnostics& diagnostics, bool output, const std::string& dir) {
+    if (!output) {
+        if (cfd.cfl <= 0.0f) return 0;
+        return start_diagnostics(init, compute_handler, readback, cfd, diagnostics, 0, nullptr);
+    }
+    auto csv = std::make_shared<std::ofstream>(dir + "/diagnostics.csv");
+    if (!csv->is_open()) {
+        std::cout << "failed to open " << dir << "/diagnostics.csv\n";
+        return -1;
+    }
+    *csv << "step,member,kinetic_energy,max_speed,max_divergence,mass,dt,time\n";
+    auto blownUp = std::make_shared<std::vector<bool>>(cfd.members, false);
+    auto write = [csv, blownUp](long step, int member, const DiagnosticsResult& result) {
+        *csv << step << "," << member << "," << result.kineticEnergy << "," << result.maxSpeed << ","
+             << result.maxDivergence << "," << result.mass << "," << result.dt << "," << result.time << "\n";
+        if (!(*blownUp)[member] && !(std::isfinite(result.kineticEnergy) && std::isfinite(result.maxSpeed))) {
+            (*blownUp)[member] = true;
+            std::cout << "warning: member " << member << " blew up at step " << step << std::endl;
+        }
+    };
+    return start_diagnostics(init, compute_handler, readback, cfd, diagnostics, 1, write);
+}
+
+// Writes <dir>/stats_<member>.raw for every member: the StatisticsPlane
+// planes one after another
+int write_statistics(Init& init, Cfd& cfd, Statistics& stats, const std::string& dir) {
+    if (stats.moments.size == 0) return 0;
+    std::vector<float> values;
+    for (int m = 0; m < cfd.members; m++) {
+        read_statistics(init, cfd, stats, m, values);
+        std::string filename = dir + "/stats_" + std::to_string(m) + ".raw";
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+        if (!file.good()) {
+            std::cout << "failed to write " << filename << "\n";
+            return -1;
+        }
+    }
+    std::cout << "Statistics over " << stats.samples << " steps written to " << dir << "\n";
+    return 0;
+}
+
+// What a GPU run sets up around the solver: the FFT projection, the
+// --validate checks and everything fed by readback, with their options
+struct RunOutputs {
+    bool validate = false;
+    int fftSweeps = -1;
+    std::string checkpointFile;
+    int checkpointEvery = 0;
+    FieldTolerances tolerances;
+    int vtkEvery = 0;
+    std::string probeFile;
+    int probeRing = 0;
+    long statsSpinUp = -1;
+    bool diagnose = false;
+    std::vector<Recording> recordings;
+
+    Readback readback;
+    Probes probes;
+    Statistics stats;
+    Diagnostics diagnostics;
+    FftProjection fftProjection;
+};
+
+// Starts everything in outputs on a loaded cfd, writing files to dir
+int start_outputs(Init& init, ComputeHandler& compute_handler, Cfd& cfd, RunOutputs& outputs, const std::string& dir) {
+    if (outputs.fftSweeps >= 0 &&
+        0 != start_fft_projection(init, compute_handler, cfd, outputs.fftProjection, outputs.fftSweeps)) return -1;
+    if (outputs.validate && outputs.fftSweeps >= 0) check_fft_projection(init, compute_handler, cfd, outputs.fftProjection);
+    if (outputs.validate) validate_cfd(init, compute_handler, cfd);
+
+    Readback& readback = outputs.readback;
+    if (outputs.checkpointEvery > 0 && !outputs.checkpointFile.empty() &&
+        0 != subscribe_checkpoints(init, readback, cfd, outputs.checkpointFile, outputs.checkpointEvery,
+            outputs.tolerances)) return -1;
+    if (outputs.vtkEvery > 0 && 0 != subscribe_vtk_export(readback, cfd, dir, outputs.vtkEvery)) return -1;
+    if (0 != start_probe_output(init, compute_handler, cfd, readback, outputs.probes, outputs.probeFile,
+            outputs.probeRing, dir)) return -1;
+    if (outputs.statsSpinUp >= 0 &&
+        0 != start_statistics(init, compute_handler, cfd, outputs.stats, cfd.step + outputs.statsSpinUp)) return -1;
+    if (0 != start_diagnostics_output(init, compute_handler, cfd, readback, outputs.diagnostics, outputs.diagnose,
+            dir)) return -1;
+    return start_recording(init, compute_handler, cfd, readback, outputs.recordings, dir);
+}
+
+// Delivers the outstanding readbacks and probes, writes the statistics and
+// the final checkpoint, then frees the outputs and the cfd
+void finish_outputs(Init& init, ComputeHandler& compute_handler, Cfd& cfd, RunOutputs& outputs, const std::string& dir) {
+    flush_readback(outputs.readback);
+    init.disp.deviceWaitIdle();
+    flush_probes(init, cfd, outputs.probes);
+    write_statistics(init, cfd, outputs.stats, dir);
+    if (!outputs.checkpointFile.empty()) save_checkpoint(init, cfd, outputs.checkpointFile, outputs.tolerances);
+
+    cleanup(init, compute_handler, outputs.readback);
+    cleanup(init, cfd, outputs.probes);
+    cleanup(init, cfd, outputs.stats);
+    cleanup(init, cfd, outputs.diagnostics);
+    cleanup(init, cfd, outputs.fftProjection);
+    cleanup(init, cfd);
+}
+
+// Runs without a window: the sweep if there is one, otherwise a single run of
+// settings.maxSteps steps, stopping early at steady state if steady is set
+int run_batch(Init& init, ComputeHandler& compute_handler, Cfd& cfd, const std::vector<Inflow>& sweep,
+    const SweepSettings& settings, bool steady) {
+    if (!sweep.empty()) return run_sweep(init, compute_handler, cfd, sweep, settings);
+
+    if (!steady) {
+        run_steps(init, compute_handler, cfd, settings.maxSteps);
+        return 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    float change;
+    int steps = run_to_steady_state(init, compute_handler, cfd, settings, change);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << steps << " steps in " << seconds << " s (" << steps / seconds << " steps/s), change " << change
+              << (change < settings.tolerance ? "" : " (not steady)") << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
     Init init;
     RenderData render_data;
     ComputeHandler compute_handler;
     Cfd cfd;
 
-    const int gridSize = 129;
+    int gridSize = 129;
+
+    std::string terrainFile = heightFile;
+    int steps = 100;
+    bool scaling = false;
+    bool advectionBench = false;
+    bool headless = false;
+    bool steady = false;
+    std::string sweepFile;
+    SweepSettings sweepSettings;
+    RunOutputs outputs;
+    std::string restartFile;
 
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--cpu") {
+            cfd.backend = Backend::cpu;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            cfd.cpu.nThreads = std::atoi(argv[++i]);
+        } else if (arg == "--grid-size" && i + 1 < argc) {
+            gridSize = std::atoi(argv[++i]);
+            if (gridSize < 4) {
+                std::cout << "--grid-size must be at least 4\n";
+                return -1;
+            }
+        } else if (arg == "--steps" && i + 1 < argc) {
+            steps = std::atoi(argv[++i]);
+        } else if (arg == "--terrain" && i + 1 < argc) {
+            terrainFile = argv[++i];
+        } else if (arg == "--parse-bench" && i + 1 < argc) {
+            return run_parse_benchmark(std::atoi(argv[++i]));
+        } else if (arg == "--convert-terrain" && i + 2 < argc) {
+            std::string textFile = argv[++i];
+            return convert_height_map(textFile, argv[++i]);
+        } else if (arg == "--decompress" && i + 2 < argc) {
+            std::string compressedFile = argv[++i];
+            return decompress_file(compressedFile, argv[++i]);
+        } else if (arg == "--build-pyramid" && i + 2 < argc) {
+            std::string heightFile = argv[++i];
+            return build_height_pyramid(heightFile, argv[++i]);
+        } else if (arg == "--validate") {
+            outputs.validate = true;
+        } else if (arg == "--scaling") {
+            scaling = true;
+        } else if (arg == "--advection-bench") {
+            advectionBench = true;
+        } else if (arg == "--maccormack") {
+            cfd.maccormack = true;
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--mask-cache" && i + 1 < argc) {
+            cfd.maskCacheDir = argv[++i];
+        } else if (arg == "--cut-cells") {
+            cfd.cutCells = true;
+        } else if (arg == "--fft-projection" && i + 1 < argc) {
+            outputs.fftSweeps = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--unfused") {
+            cfd.fusedAdvection = false;
+        } else if (arg == "--buoyancy" && i + 1 < argc) {
+            cfd.buoyancy = std::atof(argv[++i]);
+        } else if (arg == "--heat-flux" && i + 1 < argc) {
+            cfd.surfaceHeatFlux = std::atof(argv[++i]);
+        } else if (arg == "--display-scale" && i + 1 < argc) {
+            cfd.displayScale = std::atoi(argv[++i]);
+            if (cfd.displayScale != 1 && cfd.displayScale != 2 && cfd.displayScale != 4) {
+                std::cout << "--display-scale must be 1, 2 or 4\n";
+                return -1;
+            }
+        } else if (arg == "--record" && i + 2 < argc) {
+            Recording rec;
+            rec.name = argv[++i];
+            rec.every = std::max(1, std::atoi(argv[++i]));
+            if (0 != parse_field(rec.name, rec.field)) {
+                std::cout << "unknown field " << rec.name << "\n";
+                return -1;
+            }
+            outputs.recordings.push_back(rec);
+        } else if (arg == "--probes" && i + 2 < argc) {
+            outputs.probeFile = argv[++i];
+            outputs.probeRing = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--diagnostics") {
+            outputs.diagnose = true;
+        } else if (arg == "--cfl" && i + 1 < argc) {
+            cfd.cfl = std::max(0.0f, float(std::atof(argv[++i])));
+        } else if (arg == "--stats" && i + 1 < argc) {
+            outputs.statsSpinUp = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--export-vtk" && i + 1 < argc) {
+            outputs.vtkEvery = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--tolerance" && i + 2 < argc) {
+            std::string name = argv[++i];
+            Field field;
+            float tolerance = std::atof(argv[++i]);
+            if (0 != parse_field(name, field) || !(tolerance > 0.0f)) {
+                std::cout << "bad tolerance for " << name << "\n";
+                return -1;
+            }
+            outputs.tolerances[name] = tolerance;
+        } else if (arg == "--checkpoint" && i + 2 < argc) {
+            outputs.checkpointFile = argv[++i];
+            outputs.checkpointEvery = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--restart" && i + 1 < argc) {
+            restartFile = argv[++i];
+        } else if (arg == "--steady") {
+            steady = true;
+        } else if (arg == "--sweep" && i + 1 < argc) {
+            sweepFile = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            sweepSettings.outputDir = argv[++i];
+        } else if (arg == "--ensemble" && i + 1 < argc) {
+            // Members with the default inflow speed, directions evenly spread around the horizon
+            int members = std::max(1, std::atoi(argv[++i]));
+            cfd.ensemble.resize(members);
+            for (int m = 0; m < members; m++) {
+                cfd.ensemble[m].direction = 2.0f * float(M_PI) * m / members;
+            }
+        } else {
+            std::cout << "unknown argument " << arg << "\n";
+            return -1;
+        }
+    }
+
+    const bool thermal = cfd.buoyancy != 0.0f || cfd.surfaceHeatFlux != 0.0f;
+    if (thermal && !cfd.fusedAdvection) {
+        std::cout << "--buoyancy and --heat-flux need the fused advection pass, not --unfused\n";
+        return -1;
+    }
+
+    if (scaling) {
+        run_scaling(init, compute_handler, gridSize, terrainFile, steps);
+        return 0;
+    }
+
+    std::vector<Inflow> sweep;
+    if (!sweepFile.empty() && 0 != load_sweep(sweepFile, sweep)) return -1;
+    for (Recording& rec : outputs.recordings) {
+        if (outputs.tolerances.count(rec.name)) rec.tolerance = outputs.tolerances[rec.name];
+    }
+    sweepSettings.maxSteps = steps;
+
+    // The CPU backend needs no Vulkan device and always runs as a batch
+    if (cfd.backend == Backend::cpu) {
+        if (!outputs.recordings.empty() || outputs.vtkEvery > 0 || !outputs.probeFile.empty() ||
+            outputs.statsSpinUp >= 0 || outputs.diagnose) {
+            std::cout << "--record, --export-vtk, --probes, --stats and --diagnostics need the GPU backend\n";
+            return -1;
+        }
+        if (outputs.checkpointEvery > 0) std::cout << "CPU backend checkpoints at the end of the run only\n";
+        if (cfd.cfl > 0.0f) std::cout << "CPU backend keeps the fixed timestep, ignoring --cfl\n";
+        if (thermal) std::cout << "CPU backend has no temperature, ignoring --buoyancy and --heat-flux\n";
+        if (cfd.maccormack) std::cout << "CPU backend advects semi-Lagrangian, ignoring --maccormack\n";
+        if (outputs.fftSweeps >= 0) std::cout << "CPU backend projects with Gauss-Seidel, ignoring --fft-projection\n";
+        init_cfd(init, compute_handler, cfd, gridSize);
+        if (0 != load_state(init, compute_handler, cfd, terrainFile, restartFile)) return -1;
+        std::cout << "CPU backend: " << cfd.cpu.nThreads << " threads, " << cpu_simd_name() << "\n";
+        tune_gauss_siedel(cfd.cpu);
+        int res = run_batch(init, compute_handler, cfd, sweep, sweepSettings, steady);
+        if (!outputs.checkpointFile.empty()) save_checkpoint(init, cfd, outputs.checkpointFile, outputs.tolerances);
+        cleanup(init, cfd);
+        return res;
+    }
+
+    // Sweeps and benchmarks never present, so they always run headless
+    init.headless = headless || !sweep.empty() || advectionBench;
     if (0 != device_initialization(init)) return -1;
+
+    // Compute only: evolve_cfd in a tight loop, with no frames to present
+    if (init.headless) {
+        if (0 != get_comp_queue(init, compute_handler)) return -1;
+        if (0 != create_command_pool(init, compute_handler)) return -1;
+        if (advectionBench) {
+            run_advection_benchmark(init, compute_handler, gridSize, terrainFile, steps);
+            cleanup(init, compute_handler);
+            cleanup(init);
+            return 0;
+        }
+        init_cfd(init, compute_handler, cfd, gridSize);
+        if (0 != load_state(init, compute_handler, cfd, terrainFile, restartFile)) return -1;
+        if (cfd.members > 1) std::cout << "Ensemble of " << cfd.members << " members\n";
+        if (0 != start_outputs(init, compute_handler, cfd, outputs, sweepSettings.outputDir)) return -1;
+
+        int res = run_batch(init, compute_handler, cfd, sweep, sweepSettings, steady);
+        finish_outputs(init, compute_handler, cfd, outputs, sweepSettings.outputDir);
+        cleanup(init, compute_handler);
+        cleanup(init);
+        return res;
+    }
+
     if (0 != create_swapchain(init)) return -1;
     if (0 != get_queues(init, render_data)) return -1;
     if (0 != create_render_pass(init, render_data)) return -1;
@@ -57,9 +641,11 @@ int main() {
     // Later will need a different render pass to draw standard geometry
 
     init_cfd(init, compute_handler, cfd, gridSize);
-    load_terrain(init, cfd, heightFile);
+    if (0 != load_state(init, compute_handler, cfd, terrainFile, restartFile)) return -1;
+    if (cfd.members > 1) std::cout << "Ensemble of " << cfd.members << " members, showing member 0\n";
+    if (0 != start_outputs(init, compute_handler, cfd, outputs, sweepSettings.outputDir)) return -1;
 
-    std::vector<texture> textures = {cfd.densityTex};
+    std::vector<texture> textures = {cfd.displayTex};
     
     if (0 != create_graphics_pipeline(init, render_data, textures)) return -1;
     if (0 != create_framebuffers(init, render_data)) return -1;
@@ -79,11 +665,9 @@ int main() {
         }
 
         evolve_cfd(init, compute_handler, cfd);
-
+        update_display(init, compute_handler, cfd);
     }
-    init.disp.deviceWaitIdle();
-
-    cleanup(init, cfd);
+    finish_outputs(init, compute_handler, cfd, outputs, sweepSettings.outputDir);
     cleanup(init, compute_handler);
     cleanup(init, render_data);
 
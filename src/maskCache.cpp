@@ -0,0 +1,151 @@
+#include "maskCache.hpp"
+#include "heightMap.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <random>
+
+// splitmix64 finaliser: every input bit affects every output bit
+uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const uint64_t prime = 0x100000001b3ull;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        std::memcpy(&word, p + 8 * i, 8);
+        hash = (hash ^ mix64(word)) * prime;
+    }
+    uint64_t tail = 0;
+    if (size > 8 * words) std::memcpy(&tail, p + 8 * words, size - 8 * words);
+    hash = (hash ^ mix64(tail ^ size)) * prime;
+    return mix64(hash);
+}
+
+int mask_cache_file_key(const std::string& filename, MaskCacheKey& key) {
+    std::error_code error;
+    std::filesystem::path path = std::filesystem::canonical(filename, error);
+    if (error) return -1;
+    uint64_t size = std::filesystem::file_size(path, error);
+    if (error) return -1;
+    auto time = std::filesystem::last_write_time(path, error);
+    if (error) return -1;
+
+    char head[64] = {};
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return -1;
+    file.read(head, sizeof(head));
+
+    const std::string name = path.string();
+    key.pathHash = hash_bytes(name.data(), name.size());
+    key.fileSize = size;
+    key.fileTime = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+    key.formatHash = hash_bytes(head, size_t(file.gcount()));
+    return 0;
+}
+
+std::string mask_cache_path(const std::string& dir, uint64_t key) {
+    std::ostringstream name;
+    name << dir << "/" << std::hex << key << ".mask";
+    return name.str();
+}
+
+int read_mask_cache(const std::string& dir, const MaskCacheKey& key, size_t cells, std::vector<float>& mask) {
+    const uint64_t hash = hash_bytes(&key, sizeof(key));
+    FileView view;
+    if (0 != open_file_view(mask_cache_path(dir, hash), view)) return 1;
+
+    MaskCacheHeader header;
+    MaskCacheKey stored;
+    const size_t prefix = sizeof(header) + sizeof(stored);
+    int res = -1;
+    if (view.size >= prefix) {
+        std::memcpy(&header, view.data, sizeof(header));
+        std::memcpy(&stored, view.data + sizeof(header), sizeof(stored));
+        // A hash collision or a stale entry shows up as a different stored key
+        bool valid = std::memcmp(header.magic, MaskCacheHeader().magic, 4) == 0 &&
+                     header.version == MaskCacheHeader().version && header.key == hash &&
+                     std::memcmp(&stored, &key, sizeof(key)) == 0 && header.cells == cells &&
+                     view.size == prefix + header.nRuns * sizeof(uint32_t);
+        if (valid) {
+            mask.resize(cells);
+            const char* runs = view.data + prefix;
+            size_t pos = 0;
+            for (uint64_t r = 0; r < header.nRuns && valid; r++) {
+                uint32_t length;
+                std::memcpy(&length, runs + r * sizeof(uint32_t), sizeof(uint32_t));
+                if (length > cells - pos) {
+                    valid = false;
+                    break;
+                }
+                std::fill(mask.begin() + pos, mask.begin() + pos + length, float(r % 2));
+                pos += length;
+            }
+            if (valid && pos == cells) res = 0;
+        }
+    }
+    close_file_view(view);
+    if (res != 0) std::cout << "ignoring damaged or mismatched mask cache entry " << mask_cache_path(dir, hash) << "\n";
+    return res;
+}
+
+int write_mask_cache(const std::string& dir, const MaskCacheKey& key, const std::vector<float>& mask) {
+    std::vector<uint32_t> runs;
+    float value = 0.0f;
+    uint32_t length = 0;
+    for (float b : mask) {
+        float cell = b != 0.0f ? 1.0f : 0.0f;
+        if (cell != value) {
+            runs.push_back(length);
+            value = cell;
+            length = 0;
+        }
+        length++;
+    }
+    runs.push_back(length);
+
+    MaskCacheHeader header;
+    header.key = hash_bytes(&key, sizeof(key));
+    header.cells = mask.size();
+    header.nRuns = runs.size();
+
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    std::string path = mask_cache_path(dir, header.key);
+    std::ostringstream tmp;
+    // Unique per writer, so concurrent runs never share a temporary file
+    tmp << path << ".tmp" << std::hex << std::random_device()();
+    {
+        std::ofstream file(tmp.str(), std::ios::binary);
+        if (!file.is_open()) {
+            std::cout << "failed to open " << tmp.str() << "\n";
+            return -1;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+        file.write(reinterpret_cast<const char*>(runs.data()), runs.size() * sizeof(uint32_t));
+        if (!file.good()) {
+            file.close();
+            std::filesystem::remove(tmp.str(), error);
+            return -1;
+        }
+    }
+    std::filesystem::rename(tmp.str(), path, error);
+    if (error) {
+        std::cout << "failed to write " << path << ": " << error.message() << "\n";
+        std::filesystem::remove(tmp.str(), error);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk cache of finished boundary masks, one file per key named
+// <dir>/<hash of the key as hex>.mask. A file is a MaskCacheHeader, the
+// MaskCacheKey it was built for, then nRuns run lengths: alternating runs of
+// solid and fluid cells, starting with solid, so each fluid run is one span
+// of active cells.
+struct MaskCacheHeader {
+    char magic[4] = {'T', 'M', 'S', 'K'};
+    uint32_t version = 2;
+    uint64_t key = 0;
+    uint64_t cells = 0;
+    uint64_t nRuns = 0;
+};
+static_assert(sizeof(MaskCacheHeader) == 32, "mask cache header must stay 32 bytes");
+
+// Everything a mask depends on. The terrain file is identified by its path,
+// size, modification time and format header rather than by its contents,
+// which can be gigabytes; touching the file invalidates its masks.
+struct MaskCacheKey {
+    uint64_t pathHash = 0;
+    uint64_t fileSize = 0;
+    int64_t fileTime = 0;
+    // First 64 bytes of the file: the binary or pyramid header, or the ESRI one
+    uint64_t formatHash = 0;
+    int32_t gridSize = 0;
+    // Terrain window: offset, extent and height scale
+    float window[5] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+};
+static_assert(sizeof(MaskCacheKey) == 56, "mask cache key must have no padding");
+
+// 64 bit hash, eight bytes at a time with every word fully mixed in; chain
+// calls through seed
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+
+// Fills the file fields of key. Reads only the file's metadata and first 64
+// bytes. Returns -1 if the file can't be read.
+int mask_cache_file_key(const std::string& filename, MaskCacheKey& key);
+
+// Fills mask (cells 0 or 1) from the cached entry for key, which must have
+// been stored for exactly the same key. Returns 0 on a hit, 1 on a miss and
+// -1 for a damaged or mismatched entry.
+int read_mask_cache(const std::string& dir, const MaskCacheKey& key, size_t cells, std::vector<float>& mask);
+
+// Stores mask under key, writing to a temporary file and renaming it into
+// place so readers never see a partial entry
+int write_mask_cache(const std::string& dir, const MaskCacheKey& key, const std::vector<float>& mask);
@@ -0,0 +1,112 @@
+#include "probes.hpp"
+
+#include <fstream>
+
+// local_size_x of probe.comp
+const int probeWorkSize = 32;
+
+int load_probes(const std::string& filename, std::vector<Probe>& points) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "failed to open probe file " << filename << "\n";
+        return -1;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        std::istringstream fields(line);
+        Probe probe;
+        if (!(fields >> probe.x >> probe.y >> probe.z)) {
+            std::cout << filename << ":" << lineNumber << ": expected x y z\n";
+            return -1;
+        }
+        points.push_back(probe);
+    }
+    return 0;
+}
+
+// Hands steps up to `step` from the ring copy to the callback, oldest first
+void deliver_probes(Cfd& cfd, Probes& probes, long step, const std::vector<float>& ring) {
+    const size_t rowSize = size_t(3) * cfd.members * probes.count;
+    std::vector<float> row(rowSize);
+    for (long t = std::max(probes.delivered + 1, step - probes.ringSteps + 1); t <= step; t++) {
+        const float* slot = ring.data() + (t % probes.ringSteps) * rowSize;
+        row.assign(slot, slot + rowSize);
+        probes.callback(t, row);
+    }
+    probes.delivered = std::max(probes.delivered, step);
+}
+
+int start_probes(Init& init, ComputeHandler& computeHandler, Readback& readback, Cfd& cfd, Probes& probes,
+    const std::vector<Probe>& points, int ringSteps, ProbeCallback callback) {
+    if (cfd.backend != Backend::gpu) {
+        std::cout << "probes need the GPU backend\n";
+        return -1;
+    }
+    if (points.empty() || ringSteps < 1) return 0;
+
+    probes.count = points.size();
+    probes.ringSteps = ringSteps;
+    probes.step = cfd.step;
+    probes.delivered = cfd.step;
+    probes.callback = std::move(callback);
+
+    std::vector<float> positions(4 * points.size());
+    for (size_t i = 0; i < points.size(); i++) {
+        positions[4 * i] = points[i].x;
+        positions[4 * i + 1] = points[i].y;
+        positions[4 * i + 2] = points[i].z;
+    }
+    probes.positions = create_compute_buffer(init, positions.size() * sizeof(float));
+    copy_to_buffer(init, probes.positions, positions.data());
+    const uint64_t ringSize = uint64_t(3) * ringSteps * cfd.members * probes.count * sizeof(float);
+    probes.ring = create_compute_buffer(init, ringSize);
+
+    ProbePushConstants pushConsts{cfd.gridSize, probes.count, 0};
+    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, probes.positions, probes.ring};
+    std::vector<texture> textures;
+    VkShaderModule shaderProbe = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/probe.spv"));
+    const int nThreads = (probes.count + probeWorkSize - 1) / probeWorkSize;
+    probes.kernSample = build_compute_kernal(init, computeHandler, shaderProbe, buffers, textures, &pushConsts,
+        sizeof(pushConsts), nThreads, cfd.members);
+    init.disp.destroyShaderModule(shaderProbe, nullptr);
+
+    // The ring is full whenever the step is a multiple of ringSteps
+    Probes* target = &probes;
+    Cfd* owner = &cfd;
+    auto receive = [target, owner](long step, int, const std::vector<float>& ring) {
+        deliver_probes(*owner, *target, step, ring);
+    };
+    if (0 != subscribe_buffer(readback, probes.ring, 0, ringSize, ringSteps, receive)) return -1;
+    cfd.probes = &probes;
+    return 0;
+}
+
+void sample_probes(Init& init, ComputeHandler& computeHandler, Cfd& cfd, Probes& probes) {
+    probes.step++;
+    ProbePushConstants pushConsts{cfd.gridSize, probes.count, int(probes.step % probes.ringSteps)};
+    std::vector<texture> textures;
+    const int nThreads = (probes.count + probeWorkSize - 1) / probeWorkSize;
+    record_compute_kernel(probes.kernSample, textures, &pushConsts, sizeof(pushConsts), nThreads, cfd.members);
+    execute_kernel(init, computeHandler, probes.kernSample);
+}
+
+void flush_probes(Init& init, Cfd& cfd, Probes& probes) {
+    if (probes.count == 0 || probes.delivered >= probes.step) return;
+    std::vector<float> ring(probes.ring.size / sizeof(float));
+    copy_from_buffer(init, probes.ring, ring.data());
+    deliver_probes(cfd, probes, probes.step, ring);
+}
+
+void cleanup(Init& init, Cfd& cfd, Probes& probes) {
+    if (probes.count == 0) return;
+    if (cfd.probes == &probes) cfd.probes = nullptr;
+    cleanup(init, probes.kernSample);
+    std::vector<buffer> buffers = {probes.positions, probes.ring};
+    cleanup(init, buffers);
+    probes.count = 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "cfd.hpp"
+#include "readback.hpp"
+
+// Point in grid coordinates: cell (i, j, k) has its centre at (i, j, k), and
+// so do its low x, y and z faces, as in the advection step
+struct Probe {
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+};
+
+// Called on the readback thread once per step, in step order, with
+// members x probes velocities of three floats each
+using ProbeCallback = std::function<void(long step, const std::vector<float>& velocities)>;
+
+// Virtual anemometers. After every step kernSample trilinearly samples the
+// staggered velocities at each probe into one row of a ring of ringSteps
+// rows on the device; the full ring is read back through readback every
+// ringSteps steps, so the host never touches the fields.
+struct Probes {
+    int count = 0;
+    int ringSteps = 0;
+    buffer positions;
+    buffer ring;
+    kernel kernSample;
+    // Steps sampled, counted like readback.step so the ring fills in step
+    // with its readback
+    long step = 0;
+    // Last step handed to the callback
+    long delivered = 0;
+    ProbeCallback callback;
+};
+
+struct ProbePushConstants {
+    int gridSize;
+    int nProbes;
+    int slot;
+};
+
+// Reads "x y z" per line, in grid coordinates; # starts a comment
+int load_probes(const std::string& filename, std::vector<Probe>& points);
+
+// Sets up sampling at points from the next step on and subscribes the ring
+// to readback. Call before start_readback. GPU backend only.
+int start_probes(Init& init, ComputeHandler& computeHandler, Readback& readback, Cfd& cfd, Probes& probes,
+    const std::vector<Probe>& points, int ringSteps, ProbeCallback callback);
+
+// Samples the current step; called by evolve_cfd
+void sample_probes(Init& init, ComputeHandler& computeHandler, Cfd& cfd, Probes& probes);
+
+// Delivers the samples taken since the last full ring, e.g. at the end of a
+// run. Call after flush_readback.
+void flush_probes(Init& init, Cfd& cfd, Probes& probes);
+
+void cleanup(Init& init, Cfd& cfd, Probes& probes);
@@ -0,0 +1,281 @@
+#include "readback.hpp"
+
+buffer& field_buffer(Cfd& cfd, Field field) {
+    switch (field) {
+        case Field::vx: return cfd.vx;
+        case Field::vy: return cfd.vy;
+        case Field::vz: return cfd.vz;
+        case Field::density: return cfd.density;
+        case Field::pressure: return cfd.pressure;
+        case Field::temperature: return cfd.temperature;
+    }
+    return cfd.density;
+}
+
+int subscribe_range(Readback& readback, Cfd& cfd, Field field, int member, uint64_t first, uint64_t count, int every,
+    ReadbackCallback callback) {
+    if (cfd.backend != Backend::gpu) {
+        std::cout << "field readback needs the GPU backend\n";
+        return -1;
+    }
+    buffer& source = field_buffer(cfd, field);
+    const uint64_t memberSize = source.size / cfd.members;
+    if (member < 0 || member >= cfd.members || every < 1 || count == 0 ||
+        (first + count) * sizeof(float) > memberSize) {
+        std::cout << "bad readback subscription\n";
+        return -1;
+    }
+
+    Subscription sub;
+    sub.source = source;
+    sub.size = count * sizeof(float);
+    sub.offset = member * memberSize + first * sizeof(float);
+    sub.member = member;
+    sub.every = every;
+    sub.callback = std::move(callback);
+    readback.subscriptions.push_back(std::move(sub));
+    return 0;
+}
+
+int subscribe_buffer(Readback& readback, buffer& source, uint64_t offset, uint64_t size, int every,
+    ReadbackCallback callback) {
+    if (every < 1 || size == 0 || size % sizeof(float) != 0 || offset + size > source.size) {
+        std::cout << "bad readback subscription\n";
+        return -1;
+    }
+
+    Subscription sub;
+    sub.source = source;
+    sub.offset = offset;
+    sub.size = size;
+    sub.every = every;
+    sub.callback = std::move(callback);
+    readback.subscriptions.push_back(std::move(sub));
+    return 0;
+}
+
+int subscribe_field(Readback& readback, Cfd& cfd, Field field, int member, int every, ReadbackCallback callback) {
+    uint64_t count = field_buffer(cfd, field).size / cfd.members / sizeof(float);
+    return subscribe_range(readback, cfd, field, member, 0, count, every, std::move(callback));
+}
+
+void drain_readback(Init& init, Readback& readback) {
+    std::vector<float> values;
+    while (true) {
+        int s;
+        {
+            std::unique_lock<std::mutex> lock(readback.mutex);
+            readback.wake.wait(lock, [&] { return readback.stop || !readback.pending.empty(); });
+            if (readback.pending.empty()) return;
+            s = readback.pending.front();
+        }
+
+        ReadbackSlot& slot = readback.slots[s];
+        vkWaitForFences(init.device.device, 1, &slot.fence, VK_TRUE, UINT64_MAX);
+        const Subscription& sub = readback.subscriptions[slot.subscription];
+        values.assign(slot.mapped, slot.mapped + sub.size / sizeof(float));
+        long step = slot.step;
+
+        {
+            std::lock_guard<std::mutex> lock(readback.mutex);
+            readback.pending.pop_front();
+            readback.freeSlots.push_back(s);
+            readback.delivering++;
+        }
+        readback.slotFreed.notify_all();
+
+        sub.callback(step, sub.member, values);
+        {
+            std::lock_guard<std::mutex> lock(readback.mutex);
+            readback.delivering--;
+        }
+        readback.slotFreed.notify_all();
+    }
+}
+
+int start_readback(Init& init, ComputeHandler& computeHandler, Readback& readback, Cfd& cfd, int nSlots) {
+    if (readback.subscriptions.empty()) return 0;
+
+    uint64_t slotSize = 0;
+    for (const Subscription& sub : readback.subscriptions) slotSize = std::max(slotSize, sub.size);
+
+    // A transfer family other than the compute queue's, if the device has one
+    const uint32_t computeFamily = init.device.get_queue_index(vkb::QueueType::graphics).value();
+    std::vector<uint32_t> families = {computeFamily};
+    auto transferFamily = init.device.get_queue_index(vkb::QueueType::transfer);
+    auto transferQueue = init.device.get_queue(vkb::QueueType::transfer);
+    if (transferFamily.has_value() && transferQueue.has_value() && transferFamily.value() != computeFamily) {
+        VkCommandPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+        poolInfo.queueFamilyIndex = transferFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        if (vkCreateCommandPool(init.device.device, &poolInfo, nullptr, &readback.transferPool) != VK_SUCCESS) {
+            std::cout << "failed to create readback command pool\n";
+            return -1;
+        }
+        readback.transferQueue = transferQueue.value();
+        families.push_back(transferFamily.value());
+    } else {
+        std::cout << "No separate transfer queue, readback copies run on the compute queue\n";
+    }
+    const bool overlapped = readback.transferQueue != VK_NULL_HANDLE;
+
+    readback.slots.resize(std::max(1, nSlots));
+    for (size_t s = 0; s < readback.slots.size(); s++) {
+        ReadbackSlot& slot = readback.slots[s];
+        slot.staging = create_staging_buffer(init, slotSize, families);
+        void* mapped;
+        vkMapMemory(init.device.device, slot.staging.memory, 0, slotSize, 0, &mapped);
+        slot.mapped = static_cast<const float*>(mapped);
+
+        VkCommandBufferAllocateInfo cmdAllocInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+        cmdAllocInfo.commandPool = overlapped ? readback.transferPool : computeHandler.commandPool;
+        cmdAllocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        cmdAllocInfo.commandBufferCount = 1;
+        vkAllocateCommandBuffers(init.device.device, &cmdAllocInfo, &slot.cmdBuf);
+
+        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+        if (vkCreateFence(init.device.device, &fenceInfo, nullptr, &slot.fence) != VK_SUCCESS) {
+            std::cout << "failed to create readback fence\n";
+            return -1;
+        }
+
+        if (overlapped) {
+            slot.snapshot = create_device_buffer(init, slotSize, families);
+            cmdAllocInfo.commandPool = computeHandler.commandPool;
+            vkAllocateCommandBuffers(init.device.device, &cmdAllocInfo, &slot.snapshotCmdBuf);
+            VkSemaphoreCreateInfo semaphoreInfo{VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+            if (vkCreateSemaphore(init.device.device, &semaphoreInfo, nullptr, &slot.copied) != VK_SUCCESS) {
+                std::cout << "failed to create readback semaphore\n";
+                return -1;
+            }
+        }
+        readback.freeSlots.push_back(s);
+    }
+
+    readback.stop = false;
+    readback.step = cfd.step;
+    readback.thread = std::thread(drain_readback, std::ref(init), std::ref(readback));
+    cfd.readback = &readback;
+    return 0;
+}
+
+// Copies size bytes from src at offset into dst. The first barrier orders the
+// copy after the last kernel's writes; the second makes its result visible to
+// dstStage, and holds kernels there back until the copy has read src.
+void record_copy(VkCommandBuffer cmdBuf, VkBuffer src, uint64_t offset, VkBuffer dst, uint64_t size,
+    VkPipelineStageFlags dstStage, VkAccessFlags dstAccess) {
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmdBuf, &beginInfo);
+
+    VkMemoryBarrier before{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    before.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 1, &before, 0, nullptr, 0, nullptr);
+
+    VkBufferCopy region{offset, 0, size};
+    vkCmdCopyBuffer(cmdBuf, src, dst, 1, &region);
+
+    VkMemoryBarrier after{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    after.dstAccessMask = dstAccess;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStage, 0, 1, &after, 0, nullptr, 0, nullptr);
+
+    vkEndCommandBuffer(cmdBuf);
+}
+
+void readback_step(Init& init, ComputeHandler& computeHandler, Readback& readback) {
+    readback.step++;
+    for (size_t i = 0; i < readback.subscriptions.size(); i++) {
+        const Subscription& sub = readback.subscriptions[i];
+        if (readback.step % sub.every != 0) continue;
+
+        int s;
+        {
+            std::unique_lock<std::mutex> lock(readback.mutex);
+            readback.slotFreed.wait(lock, [&] { return !readback.freeSlots.empty(); });
+            s = readback.freeSlots.back();
+            readback.freeSlots.pop_back();
+        }
+
+        ReadbackSlot& slot = readback.slots[s];
+        slot.subscription = i;
+        slot.step = readback.step;
+        vkResetFences(init.device.device, 1, &slot.fence);
+
+        VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &slot.cmdBuf;
+        if (readback.transferQueue == VK_NULL_HANDLE) {
+            record_copy(slot.cmdBuf, sub.source.buffer, sub.offset, slot.staging.buffer, sub.size,
+                VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_HOST_READ_BIT);
+            vkQueueSubmit(computeHandler.queue, 1, &submitInfo, slot.fence);
+        } else {
+            // The next kernel's queue idle only waits for the device-local copy
+            record_copy(slot.snapshotCmdBuf, sub.source.buffer, sub.offset, slot.snapshot.buffer, sub.size,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+            VkSubmitInfo snapshotInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+            snapshotInfo.commandBufferCount = 1;
+            snapshotInfo.pCommandBuffers = &slot.snapshotCmdBuf;
+            snapshotInfo.signalSemaphoreCount = 1;
+            snapshotInfo.pSignalSemaphores = &slot.copied;
+            vkQueueSubmit(computeHandler.queue, 1, &snapshotInfo, VK_NULL_HANDLE);
+
+            record_copy(slot.cmdBuf, slot.snapshot.buffer, 0, slot.staging.buffer, sub.size,
+                VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+            VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            submitInfo.waitSemaphoreCount = 1;
+            submitInfo.pWaitSemaphores = &slot.copied;
+            submitInfo.pWaitDstStageMask = &waitStage;
+            vkQueueSubmit(readback.transferQueue, 1, &submitInfo, slot.fence);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(readback.mutex);
+            readback.pending.push_back(s);
+        }
+        readback.wake.notify_one();
+    }
+}
+
+void flush_readback(Readback& readback) {
+    std::unique_lock<std::mutex> lock(readback.mutex);
+    readback.slotFreed.wait(lock, [&] {
+        return readback.freeSlots.size() == readback.slots.size() && readback.delivering == 0;
+    });
+}
+
+void cleanup(Init& init, ComputeHandler& computeHandler, Readback& readback) {
+    if (readback.thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(readback.mutex);
+            readback.stop = true;
+        }
+        readback.wake.notify_one();
+        readback.thread.join();
+    }
+
+    for (ReadbackSlot& slot : readback.slots) {
+        vkUnmapMemory(init.device.device, slot.staging.memory);
+        vkDestroyBuffer(init.device.device, slot.staging.buffer, nullptr);
+        vkFreeMemory(init.device.device, slot.staging.memory, nullptr);
+        vkDestroyFence(init.device.device, slot.fence, nullptr);
+        if (readback.transferPool == VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(init.device.device, computeHandler.commandPool, 1, &slot.cmdBuf);
+            continue;
+        }
+        vkFreeCommandBuffers(init.device.device, readback.transferPool, 1, &slot.cmdBuf);
+        vkFreeCommandBuffers(init.device.device, computeHandler.commandPool, 1, &slot.snapshotCmdBuf);
+        vkDestroySemaphore(init.device.device, slot.copied, nullptr);
+        vkDestroyBuffer(init.device.device, slot.snapshot.buffer, nullptr);
+        vkFreeMemory(init.device.device, slot.snapshot.memory, nullptr);
+    }
+    readback.slots.clear();
+    readback.freeSlots.clear();
+    if (readback.transferPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(init.device.device, readback.transferPool, nullptr);
+        readback.transferPool = VK_NULL_HANDLE;
+        readback.transferQueue = VK_NULL_HANDLE;
+    }
+}
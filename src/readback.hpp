@@ -0,0 +1,104 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cfd.hpp"
+
+enum class Field {
+    vx,
+    vy,
+    vz,
+    density,
+    pressure,
+    temperature
+};
+
+// Called on the readback thread with one member's copy of a field
+using ReadbackCallback = std::function<void(long step, int member, const std::vector<float>& values)>;
+
+struct Subscription {
+    buffer source;
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    int member = 0;
+    int every = 1;
+    ReadbackCallback callback;
+};
+
+// A host-visible staging buffer and the transfer that fills it. With a
+// transfer queue, the compute queue first copies the field into the
+// device-local snapshot and signals `copied`; cmdBuf then runs on the
+// transfer queue.
+struct ReadbackSlot {
+    buffer staging;
+    const float* mapped = nullptr;
+    VkCommandBuffer cmdBuf = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    buffer snapshot{};
+    VkCommandBuffer snapshotCmdBuf = VK_NULL_HANDLE;
+    VkSemaphore copied = VK_NULL_HANDLE;
+    int subscription = 0;
+    long step = 0;
+};
+
+// Asynchronous field readback. After each step, evolve_cfd queues a copy of
+// every due subscription into a free staging slot and returns without waiting;
+// the readback thread waits on the slot's fence, copies the data out, frees
+// the slot and runs the callback. When every slot is in flight the solver
+// waits for the oldest one.
+//
+// execute_kernel idles the compute queue after every kernel, so a copy to host
+// memory on that queue would hold up the next step. When the device has a
+// separate transfer queue family, only a device-local snapshot is taken on the
+// compute queue and the copy to the staging buffer runs on the transfer queue
+// while the following steps compute. Without one, the whole copy runs on the
+// compute queue.
+struct Readback {
+    std::vector<Subscription> subscriptions;
+    std::vector<ReadbackSlot> slots;
+    long step = 0;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkCommandPool transferPool = VK_NULL_HANDLE;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable slotFreed;
+    std::deque<int> pending;
+    std::vector<int> freeSlots;
+    // Callbacks running on the readback thread
+    int delivering = 0;
+    bool stop = false;
+};
+
+// Subscribes to one ensemble member of field every `every` steps; call before
+// start_readback. GPU backend only. Returns -1 on failure.
+int subscribe_field(Readback& readback, Cfd& cfd, Field field, int member, int every, ReadbackCallback callback);
+
+// As subscribe_field, for count floats of the member starting at first, so a
+// large field can be read back a slab at a time
+int subscribe_range(Readback& readback, Cfd& cfd, Field field, int member, uint64_t first, uint64_t count, int every,
+    ReadbackCallback callback);
+
+// Reads size bytes of any device buffer from offset every `every` steps; the
+// callback's member is 0
+int subscribe_buffer(Readback& readback, buffer& source, uint64_t offset, uint64_t size, int every,
+    ReadbackCallback callback);
+
+// Creates nSlots staging slots, sized for the largest subscription, and
+// starts the readback thread. Steps of cfd are then read back until cleanup.
+int start_readback(Init& init, ComputeHandler& computeHandler, Readback& readback, Cfd& cfd, int nSlots = 3);
+
+// Queues the copies due at this step; called by evolve_cfd
+void readback_step(Init& init, ComputeHandler& computeHandler, Readback& readback);
+
+// Waits until every queued copy has been delivered
+void flush_readback(Readback& readback);
+
+void cleanup(Init& init, ComputeHandler& computeHandler, Readback& readback);
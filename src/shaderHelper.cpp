@@ -14,6 +14,7 @@ int create_command_pool(Init& init, ComputeHandler& handler) {
     VkCommandPoolCreateInfo pool_info = {};
     pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     pool_info.queueFamilyIndex = init.device.get_queue_index(vkb::QueueType::graphics).value();
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT; // kernels can be re-recorded
 
     if (init.disp.createCommandPool(&pool_info, nullptr, &handler.commandPool) != VK_SUCCESS) {
         std::cout << "failed to create command pool\n";
@@ -23,11 +24,17 @@ int create_command_pool(Init& init, ComputeHandler& handler) {
 }
 
 void create_buffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties,
-    VkPhysicalDevice physicalDevice, VkBuffer& buffer, VkDeviceMemory& memory) {
+    VkPhysicalDevice physicalDevice, VkBuffer& buffer, VkDeviceMemory& memory,
+    const std::vector<uint32_t>& queueFamilies = {}) {
     VkBufferCreateInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
     bufferInfo.size = size;
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (queueFamilies.size() > 1) {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = queueFamilies.size();
+        bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
     vkCreateBuffer(device, &bufferInfo, nullptr, &buffer);
 
     VkMemoryRequirements memRequirements;
@@ -53,12 +60,30 @@ void create_buffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage,
 buffer create_compute_buffer(Init& init, uint64_t size) {
     buffer buf;
     buf.size = size;
-    create_buffer(init.device.device, buf.size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    create_buffer(init.device.device, buf.size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
         init.device.physical_device, buf.buffer, buf.memory);
     return buf;
 }
 
+buffer create_staging_buffer(Init& init, uint64_t size, const std::vector<uint32_t>& queueFamilies) {
+    buffer buf;
+    buf.size = size;
+    create_buffer(init.device.device, buf.size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        init.device.physical_device, buf.buffer, buf.memory, queueFamilies);
+    return buf;
+}
+
+buffer create_device_buffer(Init& init, uint64_t size, const std::vector<uint32_t>& queueFamilies) {
+    buffer buf;
+    buf.size = size;
+    create_buffer(init.device.device, buf.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, init.device.physical_device, buf.buffer, buf.memory, queueFamilies);
+    return buf;
+}
+
 void copy_to_buffer(Init& init, buffer& buf, void* data) {
     void* mappedData;
     vkMapMemory(init.device.device, buf.memory, 0, buf.size, 0, &mappedData);
@@ -73,6 +98,20 @@ void copy_from_buffer(Init& init, buffer& buf, void* data) {
     vkUnmapMemory(init.device.device, buf.memory);
 }
 
+void copy_to_buffer(Init& init, buffer& buf, const void* data, uint64_t offset, uint64_t size) {
+    void* mappedData;
+    vkMapMemory(init.device.device, buf.memory, offset, size, 0, &mappedData);
+    memcpy(mappedData, data, (size_t) size);
+    vkUnmapMemory(init.device.device, buf.memory);
+}
+
+void copy_from_buffer(Init& init, buffer& buf, void* data, uint64_t offset, uint64_t size) {
+    void* mappedData;
+    vkMapMemory(init.device.device, buf.memory, offset, size, 0, &mappedData);
+    memcpy(data, mappedData, (size_t) size);
+    vkUnmapMemory(init.device.device, buf.memory);
+}
+
 kernel build_kernal(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, size_t nThreads) {
     kernel kern;
     
@@ -184,7 +223,7 @@ void execute_kernel(Init& init, ComputeHandler& handler, kernel& kern) {
 void createImage(Init& init, texture& tex) {
     VkImageCreateInfo imageInfo{VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
     imageInfo.imageType = VK_IMAGE_TYPE_3D;
-    imageInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    imageInfo.format = tex.format;
     imageInfo.extent = {tex.x, tex.y, tex.z}; // e.g. 16x16x16
     imageInfo.mipLevels = 1;
     imageInfo.arrayLayers = 1;
@@ -201,7 +240,7 @@ void createImageView(Init& init, texture& tex){
     VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
     viewInfo.image = tex.image;
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
-    viewInfo.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    viewInfo.format = tex.format;
     viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     viewInfo.subresourceRange.baseMipLevel = 0;
     viewInfo.subresourceRange.levelCount = 1;
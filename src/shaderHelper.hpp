@@ -30,6 +30,7 @@ struct texture {
     uint32_t x;
     uint32_t y;
     uint32_t z;
+    VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
     VkImage image;
     VkDeviceMemory memory;
     VkImageView imageView;
@@ -40,10 +41,18 @@ int get_comp_queue(Init& init, ComputeHandler& handler);
 int create_command_pool(Init& init, ComputeHandler& handler);
 
 buffer create_compute_buffer(Init& init, VkDeviceSize size);
+// Host-visible transfer destination, for reading buffers back. With more than
+// one queue family the buffer is shared by them, with no ownership transfers.
+buffer create_staging_buffer(Init& init, uint64_t size, const std::vector<uint32_t>& queueFamilies = {});
+// Device-local transfer source and destination, shared as above
+buffer create_device_buffer(Init& init, uint64_t size, const std::vector<uint32_t>& queueFamilies = {});
 int create_command_buffers(Init& init, RenderData& data, std::vector<texture>& textures);
 
 void copy_to_buffer(Init& init, buffer& buf, void* data);
 void copy_from_buffer(Init& init, buffer& buf, void* data);
+// size bytes starting offset bytes into the buffer
+void copy_to_buffer(Init& init, buffer& buf, const void* data, uint64_t offset, uint64_t size);
+void copy_from_buffer(Init& init, buffer& buf, void* data, uint64_t offset, uint64_t size);
 
 kernel build_kernal(Init& init, ComputeHandler& handler, VkShaderModule& shaderModule, std::vector<buffer>& buffers, size_t nThreads);
 void updateDescriptorSetForPass(Init& init, std::vector<buffer>& buffers, VkDescriptorSet descriptorSet);
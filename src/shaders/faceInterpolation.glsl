@@ -0,0 +1,57 @@
+// Indexing and trilinear sampling of the staggered velocity components,
+// shared by advect.comp and probe.comp. The including shader declares
+// gridSize and velOffset first.
+//
+// vx is (g+1) x g x g, vy g x (g+1) x g and vz g x g x (g+1) per member. A
+// position is in the component's own index space: face i of vx and cell i
+// are both at x = i, the convention the advection backtrace uses.
+
+int get_x_vel_index(ivec3 pos) {
+    return velOffset + pos.x + pos.y * (gridSize+1) + pos.z * (gridSize+1) * gridSize;
+}
+int get_y_vel_index(ivec3 pos) {
+    return velOffset + pos.x + pos.y * gridSize + pos.z * (gridSize+1) * gridSize;
+}
+int get_z_vel_index(ivec3 pos) {
+    return velOffset + pos.x + pos.y * gridSize + pos.z * gridSize * gridSize;
+}
+
+ivec3 bound_check(ivec3 pos, int sizeX, int sizeY, int sizeZ) {
+    pos.x = clamp(pos.x, 0, sizeX - 1);
+    pos.y = clamp(pos.y, 0, sizeY - 1);
+    pos.z = clamp(pos.z, 0, sizeZ - 1);
+    return pos;
+}
+
+// Trilinear interpolation of a face-centred component with sizeX x sizeY x
+// sizeZ faces per member. bounds gets the smallest and largest of the 8
+// corners, which the MacCormack correction is clamped to.
+#define DEFINE_FACE_INTERPOLATION(NAME, ARRAY, INDEX, SIZE_X, SIZE_Y, SIZE_Z) \
+float interpolate_##NAME(vec3 pos, out vec2 bounds) {                      \
+    ivec3 p0 = ivec3(floor(pos));                                          \
+    ivec3 p1 = p0 + ivec3(1);                                              \
+    p0 = bound_check(p0, SIZE_X, SIZE_Y, SIZE_Z);                          \
+    p1 = bound_check(p1, SIZE_X, SIZE_Y, SIZE_Z);                          \
+    vec3 f = fract(pos);                                                   \
+    float v000 = ARRAY[INDEX(p0)];                                         \
+    float v100 = ARRAY[INDEX(ivec3(p1.x, p0.y, p0.z))];                    \
+    float v010 = ARRAY[INDEX(ivec3(p0.x, p1.y, p0.z))];                    \
+    float v110 = ARRAY[INDEX(ivec3(p1.x, p1.y, p0.z))];                    \
+    float v001 = ARRAY[INDEX(ivec3(p0.x, p0.y, p1.z))];                    \
+    float v101 = ARRAY[INDEX(ivec3(p1.x, p0.y, p1.z))];                    \
+    float v011 = ARRAY[INDEX(ivec3(p0.x, p1.y, p1.z))];                    \
+    float v111 = ARRAY[INDEX(p1)];                                         \
+    bounds.x = min(min(min(v000, v100), min(v010, v110)), min(min(v001, v101), min(v011, v111))); \
+    bounds.y = max(max(max(v000, v100), max(v010, v110)), max(max(v001, v101), max(v011, v111))); \
+    float v00 = mix(v000, v100, f.x);                                      \
+    float v10 = mix(v010, v110, f.x);                                      \
+    float v01 = mix(v001, v101, f.x);                                      \
+    float v11 = mix(v011, v111, f.x);                                      \
+    float v0 = mix(v00, v10, f.y);                                         \
+    float v1 = mix(v01, v11, f.y);                                         \
+    return mix(v0, v1, f.z);                                               \
+}                                                                          \
+float interpolate_##NAME(vec3 pos) {                                       \
+    vec2 bounds;                                                           \
+    return interpolate_##NAME(pos, bounds);                                \
+}
@@ -12,5 +12,6 @@ void main() {
 
     // Sample the 3D texture at the computed 3D coordinates
     vec3 texCoord = vec3(fragTexCoord.x, fragTexCoord.y, zCoord);  // 3D texture coordinates
-    fragColor = texture(uTextureSampler, texCoord);  // Sample the texture at the 3D coordinates
+    float value = texture(uTextureSampler, texCoord).r;  // Single-channel display texture
+    fragColor = vec4(value, value, value, 1.0);
 }
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+// Lane types for the CPU solver. Kernels are written once as templates over one
+// of these and are instantiated for the widest ISA the build targets; Lanes1 is
+// used for row tails and is the fallback on machines without AVX2.
+
+struct Lanes1 {
+    static constexpr int width = 1;
+    static constexpr const char* name = "scalar";
+
+    using vf = float;
+    using vi = int;
+    using vm = bool;
+
+    static vf set(float a) { return a; }
+    static vi seti(int a) { return a; }
+    static vi iota(int base) { return base; }
+
+    static vf load(const float* p) { return *p; }
+    static vf load(const float* p, vm m) { return m ? *p : 0.0f; }
+    static void store(float* p, vf v) { *p = v; }
+    static void store(float* p, vf v, vm m) { if (m) *p = v; }
+
+    // Reads outside [0, size) return 0 rather than faulting
+    static vf gather(const float* base, vi idx) { return base[idx]; }
+    static vf gather(const float* base, vi idx, int size) { return (idx >= 0 && idx < size) ? base[idx] : 0.0f; }
+
+    static vf floor(vf a) { return std::floor(a); }
+    static vi to_int(vf a) { return (a > -2.0e9f && a < 2.0e9f) ? static_cast<int>(a) : (a > 0.0f ? 2000000000 : -2000000000); }
+    static vf to_float(vi a) { return static_cast<float>(a); }
+    static vi clamp(vi a, int lo, int hi) { return std::min(std::max(a, lo), hi); }
+    static vf min(vf a, vf b) { return std::min(a, b); }
+    static vf max(vf a, vf b) { return std::max(a, b); }
+
+    static vm odd(vi a) { return (a & 1) != 0; }
+    static vm ne(vf a, float b) { return a != b; }
+    static vm lt(vf a, vf b) { return a < b; }
+    static vm both(vm a, vm b) { return a && b; }
+    static vm negate(vm a) { return !a; }
+    static vf select(vm m, vf a, vf b) { return m ? a : b; }
+    static float hsum(vf a) { return a; }
+    static float hmax(vf a) { return a; }
+};
+
+#if defined(__AVX2__) && defined(__FMA__)
+struct Lanes8 {
+    static constexpr int width = 8;
+    static constexpr const char* name = "avx2";
+
+    struct vf { __m256 v; };
+    struct vi { __m256i v; };
+    struct vm { __m256 v; };
+
+    static vf set(float a) { return {_mm256_set1_ps(a)}; }
+    static vi seti(int a) { return {_mm256_set1_epi32(a)}; }
+    static vi iota(int base) { return {_mm256_add_epi32(_mm256_set1_epi32(base), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7))}; }
+
+    static vf load(const float* p) { return {_mm256_loadu_ps(p)}; }
+    static vf load(const float* p, vm m) { return {_mm256_maskload_ps(p, _mm256_castps_si256(m.v))}; }
+    static void store(float* p, vf v) { _mm256_storeu_ps(p, v.v); }
+    static void store(float* p, vf v, vm m) { _mm256_maskstore_ps(p, _mm256_castps_si256(m.v), v.v); }
+
+    static vf gather(const float* base, vi idx) { return {_mm256_i32gather_ps(base, idx.v, 4)}; }
+    static vf gather(const float* base, vi idx, int size) {
+        __m256i inside = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), idx.v),
+                                             _mm256_cmpgt_epi32(_mm256_set1_epi32(size), idx.v));
+        return {_mm256_mask_i32gather_ps(_mm256_setzero_ps(), base, idx.v, _mm256_castsi256_ps(inside), 4)};
+    }
+
+    static vf floor(vf a) { return {_mm256_floor_ps(a.v)}; }
+    static vi to_int(vf a) { return {_mm256_cvttps_epi32(a.v)}; }
+    static vf to_float(vi a) { return {_mm256_cvtepi32_ps(a.v)}; }
+    static vi clamp(vi a, int lo, int hi) { return {_mm256_min_epi32(_mm256_max_epi32(a.v, _mm256_set1_epi32(lo)), _mm256_set1_epi32(hi))}; }
+    static vf min(vf a, vf b) { return {_mm256_min_ps(a.v, b.v)}; }
+    static vf max(vf a, vf b) { return {_mm256_max_ps(a.v, b.v)}; }
+
+    static vm odd(vi a) {
+        __m256i one = _mm256_set1_epi32(1);
+        return {_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(a.v, one), one))};
+    }
+    static vm ne(vf a, float b) { return {_mm256_cmp_ps(a.v, _mm256_set1_ps(b), _CMP_NEQ_UQ)}; }
+    static vm lt(vf a, vf b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+    static vm both(vm a, vm b) { return {_mm256_and_ps(a.v, b.v)}; }
+    static vm negate(vm a) { return {_mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1)))}; }
+    static vf select(vm m, vf a, vf b) { return {_mm256_blendv_ps(b.v, a.v, m.v)}; }
+    static float hsum(vf a) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+    static float hmax(vf a) {
+        __m128 s = _mm_max_ps(_mm256_castps256_ps128(a.v), _mm256_extractf128_ps(a.v, 1));
+        s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_max_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+};
+
+inline Lanes8::vf operator+(Lanes8::vf a, Lanes8::vf b) { return {_mm256_add_ps(a.v, b.v)}; }
+inline Lanes8::vf operator-(Lanes8::vf a, Lanes8::vf b) { return {_mm256_sub_ps(a.v, b.v)}; }
+inline Lanes8::vf operator*(Lanes8::vf a, Lanes8::vf b) { return {_mm256_mul_ps(a.v, b.v)}; }
+inline Lanes8::vf operator/(Lanes8::vf a, Lanes8::vf b) { return {_mm256_div_ps(a.v, b.v)}; }
+inline Lanes8::vi operator+(Lanes8::vi a, Lanes8::vi b) { return {_mm256_add_epi32(a.v, b.v)}; }
+inline Lanes8::vi operator+(Lanes8::vi a, int b) { return {_mm256_add_epi32(a.v, _mm256_set1_epi32(b))}; }
+inline Lanes8::vi operator-(Lanes8::vi a, int b) { return {_mm256_sub_epi32(a.v, _mm256_set1_epi32(b))}; }
+inline Lanes8::vi operator*(Lanes8::vi a, int b) { return {_mm256_mullo_epi32(a.v, _mm256_set1_epi32(b))}; }
+#endif
+
+#if defined(__AVX512F__)
+struct Lanes16 {
+    static constexpr int width = 16;
+    static constexpr const char* name = "avx512";
+
+    struct vf { __m512 v; };
+    struct vi { __m512i v; };
+    struct vm { __mmask16 m; };
+
+    static vf set(float a) { return {_mm512_set1_ps(a)}; }
+    static vi seti(int a) { return {_mm512_set1_epi32(a)}; }
+    static vi iota(int base) {
+        return {_mm512_add_epi32(_mm512_set1_epi32(base), _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))};
+    }
+
+    static vf load(const float* p) { return {_mm512_loadu_ps(p)}; }
+    static vf load(const float* p, vm m) { return {_mm512_maskz_loadu_ps(m.m, p)}; }
+    static void store(float* p, vf v) { _mm512_storeu_ps(p, v.v); }
+    static void store(float* p, vf v, vm m) { _mm512_mask_storeu_ps(p, m.m, v.v); }
+
+    static vf gather(const float* base, vi idx) { return {_mm512_i32gather_ps(idx.v, base, 4)}; }
+    static vf gather(const float* base, vi idx, int size) {
+        __mmask16 inside = _mm512_cmpge_epi32_mask(idx.v, _mm512_setzero_si512()) &
+                           _mm512_cmplt_epi32_mask(idx.v, _mm512_set1_epi32(size));
+        return {_mm512_mask_i32gather_ps(_mm512_setzero_ps(), inside, idx.v, base, 4)};
+    }
+
+    static vf floor(vf a) { return {_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)}; }
+    static vi to_int(vf a) { return {_mm512_cvttps_epi32(a.v)}; }
+    static vf to_float(vi a) { return {_mm512_cvtepi32_ps(a.v)}; }
+    static vi clamp(vi a, int lo, int hi) { return {_mm512_min_epi32(_mm512_max_epi32(a.v, _mm512_set1_epi32(lo)), _mm512_set1_epi32(hi))}; }
+    static vf min(vf a, vf b) { return {_mm512_min_ps(a.v, b.v)}; }
+    static vf max(vf a, vf b) { return {_mm512_max_ps(a.v, b.v)}; }
+
+    static vm odd(vi a) { return {_mm512_test_epi32_mask(a.v, _mm512_set1_epi32(1))}; }
+    static vm ne(vf a, float b) { return {_mm512_cmp_ps_mask(a.v, _mm512_set1_ps(b), _CMP_NEQ_UQ)}; }
+    static vm lt(vf a, vf b) { return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)}; }
+    static vm both(vm a, vm b) { return {static_cast<__mmask16>(a.m & b.m)}; }
+    static vm negate(vm a) { return {static_cast<__mmask16>(~a.m)}; }
+    static vf select(vm m, vf a, vf b) { return {_mm512_mask_blend_ps(m.m, b.v, a.v)}; }
+    static float hsum(vf a) { return _mm512_reduce_add_ps(a.v); }
+    static float hmax(vf a) { return _mm512_reduce_max_ps(a.v); }
+};
+
+inline Lanes16::vf operator+(Lanes16::vf a, Lanes16::vf b) { return {_mm512_add_ps(a.v, b.v)}; }
+inline Lanes16::vf operator-(Lanes16::vf a, Lanes16::vf b) { return {_mm512_sub_ps(a.v, b.v)}; }
+inline Lanes16::vf operator*(Lanes16::vf a, Lanes16::vf b) { return {_mm512_mul_ps(a.v, b.v)}; }
+inline Lanes16::vf operator/(Lanes16::vf a, Lanes16::vf b) { return {_mm512_div_ps(a.v, b.v)}; }
+inline Lanes16::vi operator+(Lanes16::vi a, Lanes16::vi b) { return {_mm512_add_epi32(a.v, b.v)}; }
+inline Lanes16::vi operator+(Lanes16::vi a, int b) { return {_mm512_add_epi32(a.v, _mm512_set1_epi32(b))}; }
+inline Lanes16::vi operator-(Lanes16::vi a, int b) { return {_mm512_sub_epi32(a.v, _mm512_set1_epi32(b))}; }
+inline Lanes16::vi operator*(Lanes16::vi a, int b) { return {_mm512_mullo_epi32(a.v, _mm512_set1_epi32(b))}; }
+#endif
+
+#if defined(__AVX512F__)
+using LanesN = Lanes16;
+#elif defined(__AVX2__) && defined(__FMA__)
+using LanesN = Lanes8;
+#else
+using LanesN = Lanes1;
+#endif
@@ -0,0 +1,79 @@
+#include "statistics.hpp"
+
+// local_size_x of statistics.comp
+const int statisticsWorkSize = 32;
+
+int statistics_threads(const Cfd& cfd) {
+    const int cells = cfd.gridSize * cfd.gridSize * cfd.gridSize;
+    return (cells + statisticsWorkSize - 1) / statisticsWorkSize;
+}
+
+int start_statistics(Init& init, ComputeHandler& computeHandler, Cfd& cfd, Statistics& stats, long startStep) {
+    if (cfd.backend != Backend::gpu) {
+        std::cout << "running statistics need the GPU backend\n";
+        return -1;
+    }
+    const uint64_t cells = uint64_t(cfd.gridSize) * cfd.gridSize * cfd.gridSize;
+    stats.moments = create_compute_buffer(init, 8 * cells * cfd.members * sizeof(float));
+    stats.startStep = startStep;
+    reset_statistics(init, stats);
+
+    StatisticsPushConstants pushConsts{cfd.gridSize, 1.0f};
+    std::vector<buffer> buffers = {cfd.vx, cfd.vy, cfd.vz, stats.moments};
+    std::vector<texture> textures;
+    VkShaderModule shaderStatistics = createShaderModule(init, readFile(std::string(SHADER_DIR) + "/statistics.spv"));
+    stats.kernStatistics = build_compute_kernal(init, computeHandler, shaderStatistics, buffers, textures, &pushConsts,
+        sizeof(pushConsts), statistics_threads(cfd), cfd.members);
+    init.disp.destroyShaderModule(shaderStatistics, nullptr);
+
+    cfd.statistics = &stats;
+    return 0;
+}
+
+void accumulate_statistics(Init& init, ComputeHandler& computeHandler, Cfd& cfd, Statistics& stats) {
+    if (cfd.step <= stats.startStep) return;
+    stats.samples++;
+    StatisticsPushConstants pushConsts{cfd.gridSize, 1.0f / stats.samples};
+    std::vector<texture> textures;
+    record_compute_kernel(stats.kernStatistics, textures, &pushConsts, sizeof(pushConsts), statistics_threads(cfd),
+        cfd.members);
+    execute_kernel(init, computeHandler, stats.kernStatistics);
+}
+
+void reset_statistics(Init& init, Statistics& stats) {
+    std::vector<float> zeros(stats.moments.size / sizeof(float), 0.0f);
+    copy_to_buffer(init, stats.moments, zeros.data());
+    stats.samples = 0;
+}
+
+void read_statistics(Init& init, Cfd& cfd, Statistics& stats, int member, std::vector<float>& values) {
+    const size_t cells = size_t(cfd.gridSize) * cfd.gridSize * cfd.gridSize;
+    std::vector<float> moments(8 * cells);
+    copy_from_buffer(init, stats.moments, moments.data(), member * moments.size() * sizeof(float),
+        moments.size() * sizeof(float));
+
+    const int nPlanes = int(StatisticsPlane::count);
+    values.assign(nPlanes * cells, 0.0f);
+    const float invSamples = stats.samples > 0 ? 1.0f / stats.samples : 0.0f;
+    for (size_t i = 0; i < 4 * cells; i++) {
+        values[i] = moments[i];
+        values[i + 4 * cells] = moments[i + 4 * cells] * invSamples;
+    }
+
+    float* intensity = &values[int(StatisticsPlane::turbulenceIntensity) * cells];
+    const float* meanSpeed = &values[int(StatisticsPlane::meanSpeed) * cells];
+    const float* variance = &values[int(StatisticsPlane::varianceVx) * cells];
+    for (size_t c = 0; c < cells; c++) {
+        float sigma = std::sqrt((variance[c] + variance[c + cells] + variance[c + 2 * cells]) / 3.0f);
+        intensity[c] = meanSpeed[c] > 1e-6f ? sigma / meanSpeed[c] : 0.0f;
+    }
+}
+
+void cleanup(Init& init, Cfd& cfd, Statistics& stats) {
+    if (stats.moments.size == 0) return;
+    if (cfd.statistics == &stats) cfd.statistics = nullptr;
+    cleanup(init, stats.kernStatistics);
+    std::vector<buffer> buffers = {stats.moments};
+    cleanup(init, buffers);
+    stats.moments = buffer();
+}
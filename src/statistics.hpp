@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cfd.hpp"
+
+// Running mean and variance of the cell-centred velocity components and speed
+// of every cell and member, accumulated on the device with Welford's update by
+// one kernStatistics pass per step. Nothing is read back until
+// read_statistics.
+struct Statistics {
+    buffer moments{};
+    kernel kernStatistics;
+    // Steps before this one aren't accumulated, e.g. the spin-up
+    long startStep = 0;
+    long samples = 0;
+};
+
+struct StatisticsPushConstants {
+    int gridSize;
+    float invCount;
+};
+
+// Planes of gridSize^3 cells returned by read_statistics
+enum class StatisticsPlane {
+    meanVx,
+    meanVy,
+    meanVz,
+    meanSpeed,
+    varianceVx,
+    varianceVy,
+    varianceVz,
+    varianceSpeed,
+    // sqrt of the mean component variance over the mean speed
+    turbulenceIntensity,
+    count
+};
+
+// Accumulates the steps after startStep. GPU backend only.
+int start_statistics(Init& init, ComputeHandler& computeHandler, Cfd& cfd, Statistics& stats, long startStep = 0);
+
+// Folds the current step in; called by evolve_cfd
+void accumulate_statistics(Init& init, ComputeHandler& computeHandler, Cfd& cfd, Statistics& stats);
+
+// Forgets every sample so far
+void reset_statistics(Init& init, Statistics& stats);
+
+// Copies one member's moments back and fills values with the
+// StatisticsPlane::count planes, variances over the samples taken
+void read_statistics(Init& init, Cfd& cfd, Statistics& stats, int member, std::vector<float>& values);
+
+void cleanup(Init& init, Cfd& cfd, Statistics& stats);
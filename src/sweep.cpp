@@ -0,0 +1,120 @@
+#include "sweep.hpp"
+
+#include <chrono>
+#include <fstream>
+
+int load_sweep(const std::string& filename, std::vector<Inflow>& inflows) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "failed to open sweep file " << filename << "\n";
+        return -1;
+    }
+
+    inflows.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.resize(comment);
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        std::istringstream iss(line);
+        Inflow inflow;
+        float degrees;
+        if (!(iss >> inflow.speed >> degrees)) {
+            std::cout << "bad sweep line: " << line << "\n";
+            return -1;
+        }
+        inflow.direction = degrees * float(M_PI) / 180.0f;
+        inflows.push_back(inflow);
+    }
+    return 0;
+}
+
+// Largest |a - b| relative to the largest |b|
+float relative_change(const std::vector<float>& a, const std::vector<float>& b) {
+    float diff = 0.0f, scale = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        diff = std::max(diff, std::abs(a[i] - b[i]));
+        scale = std::max(scale, std::abs(b[i]));
+    }
+    return scale > 0.0f ? diff / scale : diff;
+}
+
+int run_to_steady_state(Init& init, ComputeHandler& computeHandler, Cfd& cfd, const SweepSettings& settings, float& change) {
+    std::vector<std::vector<float>> previous(3 * cfd.members), current(3 * cfd.members);
+    std::vector<float> density;
+    for (int m = 0; m < cfd.members; m++) {
+        read_member_fields(init, cfd, m, previous[3*m], previous[3*m + 1], previous[3*m + 2], density);
+    }
+
+    change = 0.0f;
+    int steps = 0;
+    while (steps < settings.maxSteps) {
+        int interval = std::min(settings.checkInterval, settings.maxSteps - steps);
+        for (int i = 0; i < interval; i++) {
+            evolve_cfd(init, computeHandler, cfd);
+        }
+        steps += interval;
+
+        change = 0.0f;
+        for (int m = 0; m < cfd.members; m++) {
+            read_member_fields(init, cfd, m, current[3*m], current[3*m + 1], current[3*m + 2], density);
+        }
+        for (size_t f = 0; f < current.size(); f++) {
+            change = std::max(change, relative_change(current[f], previous[f]) / interval);
+        }
+        if (change < settings.tolerance) break;
+        std::swap(previous, current);
+    }
+    return steps;
+}
+
+int write_result(Init& init, Cfd& cfd, int member, const std::string& filename) {
+    std::vector<float> vx, vy, vz, density;
+    read_member_fields(init, cfd, member, vx, vy, vz, density);
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cout << "failed to open " << filename << "\n";
+        return -1;
+    }
+    for (const std::vector<float>* field : {&vx, &vy, &vz, &density}) {
+        file.write(reinterpret_cast<const char*>(field->data()), field->size() * sizeof(float));
+    }
+    return file.good() ? 0 : -1;
+}
+
+int run_sweep(Init& init, ComputeHandler& computeHandler, Cfd& cfd, const std::vector<Inflow>& inflows, const SweepSettings& settings) {
+    std::ofstream summary(settings.outputDir + "/sweep.csv");
+    if (!summary.is_open()) {
+        std::cout << "failed to open " << settings.outputDir << "/sweep.csv\n";
+        return -1;
+    }
+    summary << "run, speed, direction, steps, change\n";
+
+    for (size_t first = 0; first < inflows.size(); first += cfd.members) {
+        // A short last batch repeats its final inflow in the spare members
+        for (int m = 0; m < cfd.members; m++) {
+            cfd.ensemble[m] = inflows[std::min(first + m, inflows.size() - 1)];
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        reset_cfd(init, computeHandler, cfd);
+        float change;
+        int steps = run_to_steady_state(init, computeHandler, cfd, settings, change);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (int m = 0; m < cfd.members && first + m < inflows.size(); m++) {
+            size_t run = first + m;
+            const Inflow& inflow = inflows[run];
+            float degrees = inflow.direction * 180.0f / float(M_PI);
+            if (0 != write_result(init, cfd, m, settings.outputDir + "/sweep_" + std::to_string(run) + ".raw")) return -1;
+
+            summary << run << ", " << inflow.speed << ", " << degrees << ", " << steps << ", " << change << "\n";
+            std::cout << "run " << run << ": speed " << inflow.speed << ", direction " << degrees << ", " << steps
+                      << " steps, change " << change << (change < settings.tolerance ? "" : " (not steady)")
+                      << ", " << seconds << " s\n";
+        }
+    }
+    return 0;
+}
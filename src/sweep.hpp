@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "cfd.hpp"
+
+struct SweepSettings {
+    int maxSteps = 2000;
+    // Steps between steady state checks, each of which reads the velocities back
+    int checkInterval = 50;
+    // Steady once the largest velocity change per step, relative to the largest
+    // velocity, drops below this
+    float tolerance = 1e-4f;
+    std::string outputDir = ".";
+};
+
+// Reads "speed direction" lines (direction in degrees from +x), skipping blank
+// lines and # comments. Returns -1 if the file can't be read or is malformed.
+int load_sweep(const std::string& filename, std::vector<Inflow>& inflows);
+
+// Steps every member until all are steady or maxSteps is reached. Returns the
+// number of steps taken and the last relative change in change.
+int run_to_steady_state(Init& init, ComputeHandler& computeHandler, Cfd& cfd, const SweepSettings& settings, float& change);
+
+// Runs each inflow over the already loaded terrain, cfd.members at a time,
+// resetting the fields in place between runs. Each result is written to
+// outputDir/sweep_<run>.raw as vx, vy, vz and density in the buffer layouts,
+// with one line per run in outputDir/sweep.csv.
+int run_sweep(Init& init, ComputeHandler& computeHandler, Cfd& cfd, const std::vector<Inflow>& inflows, const SweepSettings& settings);
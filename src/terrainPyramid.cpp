@@ -0,0 +1,283 @@
+#include "terrainPyramid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+// min, mean and max planes of one tile
+struct PyramidTile {
+    uint32_t size = 0;
+    std::vector<float> planes;
+
+    float* plane(PyramidChannel channel) { return planes.data() + size_t(channel) * size * size; }
+};
+
+uint64_t tile_bytes(uint32_t tileSize) {
+    return 3 * uint64_t(tileSize) * tileSize * sizeof(float);
+}
+
+uint64_t tile_offset(const PyramidLevel& level, uint32_t tileSize, uint32_t tx, uint32_t ty) {
+    return level.offset + (uint64_t(ty) * level.tilesX + tx) * tile_bytes(tileSize);
+}
+
+bool is_height_pyramid(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    PyramidHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) return false;
+    return std::memcmp(header.magic, PyramidHeader().magic, 4) == 0;
+}
+
+// Level sizes and tile offsets, halving until one tile holds the whole level
+std::vector<PyramidLevel> pyramid_levels(uint32_t cols, uint32_t rows, uint32_t tileSize) {
+    std::vector<PyramidLevel> levels;
+    while (true) {
+        PyramidLevel level;
+        level.cols = cols;
+        level.rows = rows;
+        level.tilesX = (cols + tileSize - 1) / tileSize;
+        level.tilesY = (rows + tileSize - 1) / tileSize;
+        levels.push_back(level);
+        if (cols <= tileSize && rows <= tileSize) break;
+        cols = (cols + 1) / 2;
+        rows = (rows + 1) / 2;
+    }
+
+    uint64_t offset = sizeof(PyramidHeader) + levels.size() * sizeof(PyramidLevel);
+    for (PyramidLevel& level : levels) {
+        level.offset = offset;
+        offset += uint64_t(level.tilesX) * level.tilesY * tile_bytes(tileSize);
+    }
+    return levels;
+}
+
+void base_tile(const HeightMap& map, uint32_t tx, uint32_t ty, PyramidTile& tile) {
+    const uint32_t size = tile.size;
+    for (uint32_t j = 0; j < size; j++) {
+        size_t row = std::min<size_t>(size_t(ty) * size + j, map.header.rows - 1);
+        for (uint32_t i = 0; i < size; i++) {
+            size_t col = std::min<size_t>(size_t(tx) * size + i, map.header.cols - 1);
+            float h = height_at(map, col, row);
+            tile.plane(PyramidChannel::min)[i + j * size] = h;
+            tile.plane(PyramidChannel::mean)[i + j * size] = h;
+            tile.plane(PyramidChannel::max)[i + j * size] = h;
+        }
+    }
+}
+
+// Level 0 samples along one axis under sample i of a level `scale` times
+// coarser; fewer than scale past the edge of a level 0 of size0 samples
+uint64_t covered_samples(uint32_t i, uint64_t scale, uint32_t size0) {
+    return std::min<uint64_t>((i + 1) * scale, size0) - i * scale;
+}
+
+// Reduces the 2 x 2 tiles of the level below covering tile (tx, ty). Means are
+// weighted by the level 0 samples each child covers, which differ at the edges.
+int reduced_tile(std::fstream& file, const PyramidHeader& header, const PyramidLevel& below, uint64_t belowScale,
+    const PyramidLevel& level, uint32_t tx, uint32_t ty, PyramidTile& tile, PyramidTile& child) {
+    const uint32_t size = tile.size;
+    for (uint32_t cy = 0; cy < 2; cy++) {
+        for (uint32_t cx = 0; cx < 2; cx++) {
+            uint32_t childX = 2 * tx + cx, childY = 2 * ty + cy;
+            if (childX >= below.tilesX || childY >= below.tilesY) continue;
+
+            file.seekg(tile_offset(below, size, childX, childY));
+            if (!file.read(reinterpret_cast<char*>(child.planes.data()), tile_bytes(size))) return -1;
+
+            // Quarter of this tile fed by the child tile
+            for (uint32_t j = cy * size / 2; j < (cy + 1) * size / 2; j++) {
+                uint32_t row = ty * size + j;
+                if (row >= level.rows) break;
+                for (uint32_t i = cx * size / 2; i < (cx + 1) * size / 2; i++) {
+                    uint32_t col = tx * size + i;
+                    if (col >= level.cols) break;
+
+                    float lo = INFINITY, hi = -INFINITY;
+                    double sum = 0.0, n = 0.0;
+                    for (uint32_t b = 0; b < 2; b++) {
+                        for (uint32_t a = 0; a < 2; a++) {
+                            uint32_t belowCol = 2 * col + a, belowRow = 2 * row + b;
+                            if (belowCol >= below.cols || belowRow >= below.rows) continue;
+                            size_t k = (belowCol - childX * size) + size_t(belowRow - childY * size) * size;
+                            lo = std::min(lo, child.plane(PyramidChannel::min)[k]);
+                            hi = std::max(hi, child.plane(PyramidChannel::max)[k]);
+                            double weight = double(covered_samples(belowCol, belowScale, header.cols)) *
+                                            covered_samples(belowRow, belowScale, header.rows);
+                            sum += weight * child.plane(PyramidChannel::mean)[k];
+                            n += weight;
+                        }
+                    }
+                    if (n == 0.0) continue;
+                    tile.plane(PyramidChannel::min)[i + j * size] = lo;
+                    tile.plane(PyramidChannel::mean)[i + j * size] = float(sum / n);
+                    tile.plane(PyramidChannel::max)[i + j * size] = hi;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+int build_height_pyramid(const std::string& heightFile, const std::string& pyramidFile, uint32_t tileSize) {
+    if (tileSize == 0 || tileSize % 2 != 0) {
+        std::cout << "pyramid tile size must be even\n";
+        return -1;
+    }
+
+    HeightMap map;
+    if (0 != load_height_map(heightFile, map)) return -1;
+    if (map.header.cols == 0 || map.header.rows == 0) {
+        close_height_map(map);
+        return -1;
+    }
+
+    std::fstream file(pyramidFile, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cout << "failed to open " << pyramidFile << "\n";
+        close_height_map(map);
+        return -1;
+    }
+
+    PyramidHeader header;
+    header.cols = map.header.cols;
+    header.rows = map.header.rows;
+    header.tileSize = tileSize;
+    header.spacingX = map.header.spacingX;
+    header.spacingY = map.header.spacingY;
+    header.originX = map.header.originX;
+    header.originY = map.header.originY;
+    std::vector<PyramidLevel> levels = pyramid_levels(header.cols, header.rows, tileSize);
+    header.levels = levels.size();
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(PyramidLevel));
+
+    PyramidTile tile, child;
+    tile.size = child.size = tileSize;
+    tile.planes.resize(3 * size_t(tileSize) * tileSize);
+    child.planes.resize(tile.planes.size());
+
+    for (size_t l = 0; l < levels.size(); l++) {
+        const PyramidLevel& level = levels[l];
+        for (uint32_t ty = 0; ty < level.tilesY; ty++) {
+            for (uint32_t tx = 0; tx < level.tilesX; tx++) {
+                if (l == 0) {
+                    base_tile(map, tx, ty, tile);
+                } else {
+                    std::fill(tile.planes.begin(), tile.planes.end(), 0.0f);
+                    if (0 != reduced_tile(file, header, levels[l - 1], uint64_t(1) << (l - 1), level, tx, ty, tile, child)) {
+                        std::cout << "failed to read back " << pyramidFile << "\n";
+                        close_height_map(map);
+                        return -1;
+                    }
+                    // Repeat the last row and column past the edge of the level
+                    for (int c = 0; c < 3; c++) {
+                        float* plane = tile.plane(PyramidChannel(c));
+                        for (uint32_t j = 0; j < tileSize; j++) {
+                            uint32_t row = std::min(ty * tileSize + j, level.rows - 1) - ty * tileSize;
+                            for (uint32_t i = 0; i < tileSize; i++) {
+                                uint32_t col = std::min(tx * tileSize + i, level.cols - 1) - tx * tileSize;
+                                plane[i + j * tileSize] = plane[col + row * tileSize];
+                            }
+                        }
+                    }
+                }
+                file.seekp(tile_offset(level, tileSize, tx, ty));
+                file.write(reinterpret_cast<const char*>(tile.planes.data()), tile_bytes(tileSize));
+            }
+        }
+    }
+    close_height_map(map);
+
+    if (!file.good()) {
+        std::cout << "failed to write " << pyramidFile << "\n";
+        return -1;
+    }
+    std::cout << "Wrote " << levels.size() << " level pyramid of " << header.cols << " x " << header.rows
+              << " heightmap to " << pyramidFile << "\n";
+    return 0;
+}
+
+int read_pyramid_window(const std::string& filename, PyramidChannel channel, float offsetX, float offsetY,
+    float extentX, float extentY, int targetCols, int targetRows, HeightMap& map, PyramidRegion& region) {
+    close_height_map(map);
+
+    std::ifstream file(filename, std::ios::binary);
+    PyramidHeader header;
+    if (!file.is_open() || !file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, PyramidHeader().magic, 4) != 0) {
+        std::cout << "failed to open terrain pyramid " << filename << "\n";
+        return -1;
+    }
+    if (header.version != PyramidHeader().version || header.levels == 0 || header.tileSize == 0) {
+        std::cout << "unsupported terrain pyramid " << filename << ", rebuild it with --build-pyramid\n";
+        return -1;
+    }
+    std::vector<PyramidLevel> levels(header.levels);
+    if (!file.read(reinterpret_cast<char*>(levels.data()), levels.size() * sizeof(PyramidLevel))) {
+        std::cout << "truncated terrain pyramid " << filename << "\n";
+        return -1;
+    }
+
+    if (extentX <= 0.0f) extentX = header.cols - offsetX;
+    if (extentY <= 0.0f) extentY = header.rows - offsetY;
+
+    // Coarsest level still resolving the grid
+    int l = 0;
+    while (l + 1 < int(levels.size()) && extentX / float(2 << l) >= targetCols && extentY / float(2 << l) >= targetRows) {
+        l++;
+    }
+    const PyramidLevel& level = levels[l];
+    const float scale = float(1 << l);
+
+    uint32_t col0 = std::min<uint32_t>(std::max(0.0f, std::floor(offsetX / scale)), level.cols - 1);
+    uint32_t row0 = std::min<uint32_t>(std::max(0.0f, std::floor(offsetY / scale)), level.rows - 1);
+    uint32_t col1 = std::min<uint32_t>(std::max(0.0f, std::ceil((offsetX + extentX) / scale)), level.cols);
+    uint32_t row1 = std::min<uint32_t>(std::max(0.0f, std::ceil((offsetY + extentY) / scale)), level.rows);
+    col1 = std::max(col1, col0 + 1);
+    row1 = std::max(row1, row0 + 1);
+
+    map.header = HeightMapHeader();
+    map.header.cols = col1 - col0;
+    map.header.rows = row1 - row0;
+    map.header.dtype = HeightType::f32;
+    map.header.spacingX = header.spacingX * scale;
+    map.header.spacingY = header.spacingY * scale;
+    map.header.originX = header.originX + col0 * map.header.spacingX;
+    map.header.originY = header.originY + row0 * map.header.spacingY;
+    map.owned.resize(size_t(map.header.cols) * map.header.rows);
+    map.samples = map.owned.data();
+
+    const uint32_t size = header.tileSize;
+    std::vector<float> plane(size_t(size) * size);
+    region = PyramidRegion();
+    for (uint32_t ty = row0 / size; ty <= (row1 - 1) / size; ty++) {
+        for (uint32_t tx = col0 / size; tx <= (col1 - 1) / size; tx++) {
+            file.seekg(tile_offset(level, size, tx, ty) + uint64_t(channel) * plane.size() * sizeof(float));
+            if (!file.read(reinterpret_cast<char*>(plane.data()), plane.size() * sizeof(float))) {
+                std::cout << "truncated terrain pyramid " << filename << "\n";
+                close_height_map(map);
+                return -1;
+            }
+            region.bytesRead += plane.size() * sizeof(float);
+
+            uint32_t c0 = std::max(col0, tx * size), c1 = std::min(col1, (tx + 1) * size);
+            uint32_t r0 = std::max(row0, ty * size), r1 = std::min(row1, (ty + 1) * size);
+            for (uint32_t r = r0; r < r1; r++) {
+                std::copy(plane.begin() + (c0 - tx * size) + size_t(r - ty * size) * size,
+                          plane.begin() + (c1 - tx * size) + size_t(r - ty * size) * size,
+                          map.owned.begin() + (c0 - col0) + size_t(r - row0) * map.header.cols);
+            }
+        }
+    }
+
+    region.level = l;
+    region.sourceCols = header.cols;
+    region.sourceRows = header.rows;
+    region.originX = col0 * scale;
+    region.originY = row0 * scale;
+    region.scale = scale;
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "heightMap.hpp"
+
+// Tiled DEM pyramid file: a 64 byte header, one PyramidLevel per level, then
+// the tiles of every level. Level 0 is the source heightmap and each level
+// halves the one below, rounding up. Tiles are tileSize x tileSize samples,
+// stored row by row of tiles, as three planes of f32: min, mean and max of
+// the level 0 samples they cover. Edge tiles repeat their last row and column.
+struct PyramidHeader {
+    char magic[4] = {'T', 'P', 'Y', 'R'};
+    // 2: means weighted by the samples each child covers
+    uint32_t version = 2;
+    uint32_t cols = 0;
+    uint32_t rows = 0;
+    uint32_t tileSize = 256;
+    uint32_t levels = 0;
+    uint32_t reserved[2] = {0, 0};
+    double spacingX = 1.0;
+    double spacingY = 1.0;
+    double originX = 0.0;
+    double originY = 0.0;
+};
+static_assert(sizeof(PyramidHeader) == 64, "pyramid header must stay 64 bytes");
+
+struct PyramidLevel {
+    uint32_t cols = 0;
+    uint32_t rows = 0;
+    uint32_t tilesX = 0;
+    uint32_t tilesY = 0;
+    // Byte offset of the level's first tile
+    uint64_t offset = 0;
+};
+static_assert(sizeof(PyramidLevel) == 24, "pyramid level must stay 24 bytes");
+
+enum class PyramidChannel : uint32_t {
+    min = 0,
+    mean = 1,
+    max = 2
+};
+
+// Part of a pyramid read by read_pyramid_window: level 0 sample
+// (originX + scale * c, originY + scale * r) is the start of sample (c, r) of
+// the returned map
+struct PyramidRegion {
+    int level = 0;
+    uint32_t sourceCols = 0;
+    uint32_t sourceRows = 0;
+    float originX = 0.0f;
+    float originY = 0.0f;
+    float scale = 1.0f;
+    size_t bytesRead = 0;
+};
+
+bool is_height_pyramid(const std::string& filename);
+
+// Builds a pyramid from any heightmap load_height_map reads. Works a tile at a
+// time, so a memory-mapped binary source never has to fit in RAM.
+int build_height_pyramid(const std::string& heightFile, const std::string& pyramidFile, uint32_t tileSize = 256);
+
+// Reads channel over the level 0 window [offsetX, offsetX + extentX) x
+// [offsetY, offsetY + extentY), from the coarsest level that still has at
+// least targetCols x targetRows samples across it. Only the tiles overlapping
+// the window are read. An extent of 0 covers the rest of the map.
+int read_pyramid_window(const std::string& filename, PyramidChannel channel, float offsetX, float offsetY,
+    float extentX, float extentY, int targetCols, int targetRows, HeightMap& map, PyramidRegion& region);
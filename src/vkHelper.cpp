@@ -30,10 +30,12 @@ VkSurfaceKHR create_surface_glfw(VkInstance instance, GLFWwindow* window, VkAllo
 }
 
 int device_initialization(Init& init) {
-    init.window = create_window_glfw("Thermal CFD", true);
+    if (!init.headless) init.window = create_window_glfw("Thermal CFD", true);
 
     vkb::InstanceBuilder instance_builder;
-    auto instance_ret = instance_builder.use_default_debug_messenger().request_validation_layers().build();
+    // 1.1 for subgroup operations in the reductions
+    auto instance_ret = instance_builder.use_default_debug_messenger().request_validation_layers().set_headless(init.headless)
+        .require_api_version(1, 1, 0).build();
     if (!instance_ret) {
         std::cout << instance_ret.error().message() << "\n";
         return -1;
@@ -42,16 +44,27 @@ int device_initialization(Init& init) {
 
     init.inst_disp = init.instance.make_table();
 
-    init.surface = create_surface_glfw(init.instance, init.window);
-
     vkb::PhysicalDeviceSelector phys_device_selector(init.instance);
-    auto phys_device_ret = phys_device_selector.set_surface(init.surface).select();
+    phys_device_selector.set_minimum_version(1, 1);
+    if (init.headless) {
+        phys_device_selector.require_present(false);
+    } else {
+        init.surface = create_surface_glfw(init.instance, init.window);
+        phys_device_selector.set_surface(init.surface);
+    }
+    auto phys_device_ret = phys_device_selector.select();
     if (!phys_device_ret) {
         std::cout << phys_device_ret.error().message() << "\n";
         return -1;
     }
     vkb::PhysicalDevice physical_device = phys_device_ret.value();
 
+    VkPhysicalDeviceSubgroupProperties subgroupProperties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES};
+    VkPhysicalDeviceProperties2 properties{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, &subgroupProperties};
+    vkGetPhysicalDeviceProperties2(physical_device.physical_device, &properties);
+    init.subgroupArithmetic = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+                              (subgroupProperties.supportedOperations & VK_SUBGROUP_FEATURE_ARITHMETIC_BIT);
+
     vkb::DeviceBuilder device_builder{ physical_device };
     auto device_ret = device_builder.build();
     if (!device_ret) {
@@ -529,8 +542,12 @@ void cleanup(Init& init, RenderData& data) {
     init.swapchain.destroy_image_views(data.swapchain_image_views);
 
     vkb::destroy_swapchain(init.swapchain);
+    cleanup(init);
+}
+
+void cleanup(Init& init) {
     vkb::destroy_device(init.device);
-    vkb::destroy_surface(init.instance, init.surface);
+    if (init.surface != VK_NULL_HANDLE) vkb::destroy_surface(init.instance, init.surface);
     vkb::destroy_instance(init.instance);
-    destroy_window_glfw(init.window);
+    if (init.window != nullptr) destroy_window_glfw(init.window);
 }
\ No newline at end of file
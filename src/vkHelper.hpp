@@ -15,13 +15,19 @@
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
 struct Init {
-    GLFWwindow* window;
+    // Compute only: no window, surface or swapchain
+    bool headless = false;
+
+    GLFWwindow* window = nullptr;
     vkb::Instance instance;
     vkb::InstanceDispatchTable inst_disp;
-    VkSurfaceKHR surface;
+    VkSurfaceKHR surface = VK_NULL_HANDLE;
     vkb::Device device;
     vkb::DispatchTable disp;
     vkb::Swapchain swapchain;
+
+    // Compute shaders can use subgroupAdd, subgroupMax, ...
+    bool subgroupArithmetic = false;
 };
 
 struct RenderData {
@@ -61,6 +67,8 @@ int create_command_buffers(Init& init, RenderData& data);
 int create_sync_objects(Init& init, RenderData& data);
 int draw_frame(Init& init, RenderData& data);
 void cleanup(Init& init, RenderData& data);
+// Device, surface, instance and window, for runs that never made a swapchain
+void cleanup(Init& init);
 
 VkShaderModule createShaderModule(Init& init, const std::vector<char>& code);
 std::vector<char> readFile(const std::string& filename);
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "vtkExport.hpp"
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <tuple>
+
+// One slab's staggered velocities, gathered until all four fields arrive
+struct VtkSlab {
+    std::vector<float> vx, vy, vz, density;
+    int received = 0;
+};
+
+struct VtkFile {
+    std::fstream file;
+    int slabsLeft = 0;
+};
+
+struct VtkExport {
+    std::string dir;
+    int gridSize = 0;
+    int slabDepth = 0;
+    int nSlabs = 0;
+    // Byte offsets of the density and velocity values in every file
+    uint64_t densityOffset = 0;
+    uint64_t velocityOffset = 0;
+    std::string header;
+    std::string footer;
+
+    std::map<std::tuple<long, int, int>, VtkSlab> slabs;
+    std::map<std::pair<long, int>, VtkFile> files;
+};
+
+// XML up to the start of the appended data. Sizes are UInt64 so fields over
+// 4 GB still load.
+void vtk_layout(VtkExport& vtk) {
+    const uint64_t g = vtk.gridSize;
+    const uint64_t densityBytes = g * g * g * sizeof(float);
+
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"ImageData\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\">\n"
+        << "  <ImageData WholeExtent=\"0 " << g << " 0 " << g << " 0 " << g << "\" Origin=\"0 0 0\" Spacing=\"1 1 1\">\n"
+        << "    <Piece Extent=\"0 " << g << " 0 " << g << " 0 " << g << "\">\n"
+        << "      <CellData Scalars=\"density\" Vectors=\"velocity\">\n"
+        << "        <DataArray type=\"Float32\" Name=\"density\" format=\"appended\" offset=\"0\"/>\n"
+        << "        <DataArray type=\"Float32\" Name=\"velocity\" NumberOfComponents=\"3\" format=\"appended\" offset=\""
+        << sizeof(uint64_t) + densityBytes << "\"/>\n"
+        << "      </CellData>\n"
+        << "    </Piece>\n"
+        << "  </ImageData>\n"
+        << "  <AppendedData encoding=\"raw\">\n_";
+    vtk.header = xml.str();
+    vtk.footer = "\n  </AppendedData>\n</VTKFile>\n";
+    vtk.densityOffset = vtk.header.size() + sizeof(uint64_t);
+    vtk.velocityOffset = vtk.densityOffset + densityBytes + sizeof(uint64_t);
+}
+
+// Creates the file with its XML, array sizes and footer; the slabs fill the gap
+int open_vtk_file(const VtkExport& vtk, VtkFile& out, const std::string& filename) {
+    out.file.open(filename, std::ios::in | std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!out.file.is_open()) {
+        std::cout << "failed to open " << filename << "\n";
+        return -1;
+    }
+    const uint64_t g = vtk.gridSize;
+    const uint64_t densityBytes = g * g * g * sizeof(float);
+    const uint64_t velocityBytes = 3 * densityBytes;
+
+    out.file.write(vtk.header.data(), vtk.header.size());
+    out.file.write(reinterpret_cast<const char*>(&densityBytes), sizeof(densityBytes));
+    out.file.seekp(vtk.velocityOffset - sizeof(uint64_t));
+    out.file.write(reinterpret_cast<const char*>(&velocityBytes), sizeof(velocityBytes));
+    out.file.seekp(vtk.velocityOffset + velocityBytes);
+    out.file.write(vtk.footer.data(), vtk.footer.size());
+    out.slabsLeft = vtk.nSlabs;
+    return 0;
+}
+
+// Averages the two faces of each cell in slab z0 and writes density and
+// velocity into place
+void write_vtk_slab(const VtkExport& vtk, VtkFile& out, int z0, const VtkSlab& slab) {
+    const int g = vtk.gridSize;
+    const int depth = slab.density.size() / (size_t(g) * g);
+
+    std::vector<float> velocity(3 * slab.density.size());
+    for (int z = 0; z < depth; z++) {
+        for (int y = 0; y < g; y++) {
+            for (int x = 0; x < g; x++) {
+                size_t c = x + g * (y + size_t(g) * z);
+                size_t ix = x + (g + 1) * (y + size_t(g) * z);
+                size_t iy = x + g * (y + size_t(g + 1) * z);
+                velocity[3 * c] = 0.5f * (slab.vx[ix] + slab.vx[ix + 1]);
+                velocity[3 * c + 1] = 0.5f * (slab.vy[iy] + slab.vy[iy + g]);
+                velocity[3 * c + 2] = 0.5f * (slab.vz[c] + slab.vz[c + size_t(g) * g]);
+            }
+        }
+    }
+
+    const uint64_t first = uint64_t(z0) * g * g;
+    out.file.seekp(vtk.densityOffset + first * sizeof(float));
+    out.file.write(reinterpret_cast<const char*>(slab.density.data()), slab.density.size() * sizeof(float));
+    out.file.seekp(vtk.velocityOffset + 3 * first * sizeof(float));
+    out.file.write(reinterpret_cast<const char*>(velocity.data()), velocity.size() * sizeof(float));
+}
+
+int subscribe_vtk_export(Readback& readback, Cfd& cfd, const std::string& dir, int every, uint64_t slabBytes) {
+    auto vtk = std::make_shared<VtkExport>();
+    const uint64_t g = cfd.gridSize;
+    vtk->dir = dir;
+    vtk->gridSize = g;
+    vtk->slabDepth = std::max<uint64_t>(1, std::min<uint64_t>(g, slabBytes / ((g + 1) * g * sizeof(float))));
+    vtk->nSlabs = (g + vtk->slabDepth - 1) / vtk->slabDepth;
+    vtk_layout(*vtk);
+
+    const Field fields[] = {Field::vx, Field::vy, Field::vz, Field::density};
+    for (int m = 0; m < cfd.members; m++) {
+        for (int s = 0; s < vtk->nSlabs; s++) {
+            const uint64_t z0 = uint64_t(s) * vtk->slabDepth;
+            const uint64_t depth = std::min<uint64_t>(vtk->slabDepth, g - z0);
+            for (int f = 0; f < 4; f++) {
+                // Faces in x or y add a row or column to each slice; vz also
+                // needs the face above the slab's top cells
+                uint64_t slice = fields[f] == Field::vx || fields[f] == Field::vy ? (g + 1) * g : g * g;
+                uint64_t slices = fields[f] == Field::vz ? depth + 1 : depth;
+
+                auto receive = [vtk, s, f, z0](long step, int member, const std::vector<float>& values) {
+                    VtkSlab& slab = vtk->slabs[{step, member, s}];
+                    std::vector<float>* parts[] = {&slab.vx, &slab.vy, &slab.vz, &slab.density};
+                    *parts[f] = values;
+                    if (++slab.received < 4) return;
+
+                    auto key = std::make_pair(step, member);
+                    std::string filename = vtk->dir + "/flow_" + std::to_string(member) + "_" + std::to_string(step) + ".vti";
+                    if (!vtk->files.count(key) && 0 != open_vtk_file(*vtk, vtk->files[key], filename)) {
+                        vtk->files.erase(key);
+                        vtk->slabs.erase({step, member, s});
+                        return;
+                    }
+                    VtkFile& out = vtk->files[key];
+                    write_vtk_slab(*vtk, out, z0, slab);
+                    vtk->slabs.erase({step, member, s});
+                    if (--out.slabsLeft > 0) return;
+
+                    if (!out.file.good()) std::cout << "failed to write " << filename << "\n";
+                    vtk->files.erase(key);
+                };
+                if (0 != subscribe_range(readback, cfd, fields[f], m, z0 * slice, slices * slice, every, receive)) return -1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+
+#include "cfd.hpp"
+#include "readback.hpp"
+
+// Writes <dir>/flow_<member>_<step>.vti every `every` steps: VTK ImageData
+// with cell-centred density and velocity in raw appended binary, for
+// ParaView. The fields are read back in z-slabs of at most slabBytes of vx,
+// which are centred and written into place as they arrive, so the host never
+// holds a whole field. Call before start_readback. GPU backend only.
+int subscribe_vtk_export(Readback& readback, Cfd& cfd, const std::string& dir, int every,
+    uint64_t slabBytes = 8 << 20);
@@ -0,0 +1,156 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "crc32.hpp"
+#include "fieldCompression.hpp"
+#include "heightMap.hpp"
+
+// Checks of the CPU-side file formats: the CRC-32 of checkpoint chunks, the
+// lossy field compression and the text heightmap parsers. Prints every
+// failure and returns non-zero if there was one.
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cout << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+void test_crc32() {
+    const char* text = "123456789";
+    check(crc32(text, 9) == 0xCBF43926u, "crc32 check value of \"123456789\"");
+    // Split across calls, and past the 8 byte slices
+    check(crc32(text + 3, 6, crc32(text, 3)) == 0xCBF43926u, "crc32 continued over a second call");
+    check(crc32(text, 0) == 0u, "crc32 of no data");
+}
+
+void test_compression() {
+    const uint32_t nx = 19, ny = 13, nz = 21;
+    const float tolerance = 1e-3f;
+    std::vector<float> values(nx * ny * nz);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = std::sin(0.1f * i) + 0.01f * float(i % 7);
+    }
+    // Values the quantiser can't code go through the escape
+    values[5] = std::numeric_limits<float>::quiet_NaN();
+    values[nx * ny + 3] = std::numeric_limits<float>::infinity();
+    values[values.size() - 1] = -std::numeric_limits<float>::infinity();
+    values[100] = 1e30f;
+    values[101] = -1e30f;
+
+    std::vector<unsigned char> compressed;
+    check(compress_field(values.data(), nx, ny, nz, tolerance, compressed) == 0, "compress_field");
+    check(compress_field(values.data(), nx, ny, nz, 0.0f, compressed) != 0, "compress_field rejects tolerance 0");
+    check(compress_field(values.data(), nx, ny, nz, tolerance, compressed) == 0, "compress_field again");
+
+    std::vector<float> decoded;
+    check(decompress_field(compressed.data(), compressed.size(), decoded) == 0, "decompress_field");
+    check(decoded.size() == values.size(), "decompressed value count");
+    if (decoded.size() != values.size()) return;
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < values.size(); i++) {
+        float v = values[i], d = decoded[i];
+        bool ok = std::isnan(v) ? std::isnan(d) : std::isinf(v) ? d == v : std::abs(d - v) <= tolerance;
+        wrong += !ok;
+    }
+    check(wrong == 0, std::to_string(wrong) + " values outside the tolerance after a round trip");
+
+    check(decompress_field(compressed.data(), compressed.size() - 1, decoded) != 0,
+        "decompress_field rejects a truncated field");
+}
+
+// Writes text to a temporary file and loads it with load_height_map
+int load_text(const std::string& name, const std::string& text, HeightMap& map) {
+    std::string filename = (std::filesystem::temp_directory_path() / name).string();
+    {
+        std::ofstream file(filename, std::ios::binary);
+        file << text;
+    }
+    int res = load_height_map(filename, map, 2);
+    std::filesystem::remove(filename);
+    return res;
+}
+
+// Expects a cols x rows map whose samples, row 0 first, are heights
+void check_map(const HeightMap& map, uint32_t cols, uint32_t rows, const std::vector<float>& heights,
+    const std::string& what) {
+    check(map.header.cols == cols && map.header.rows == rows, what + ": dimensions");
+    if (map.header.cols != cols || map.header.rows != rows) return;
+    for (uint32_t r = 0; r < rows; r++) {
+        for (uint32_t c = 0; c < cols; c++) {
+            float expected = heights[c + r * cols];
+            float h = height_at(map, c, r);
+            bool ok = std::isnan(expected) ? std::isnan(h) : h == expected;
+            check(ok, what + ": sample (" + std::to_string(c) + ", " + std::to_string(r) + ")");
+        }
+    }
+}
+
+void test_height_maps() {
+    HeightMap map;
+
+    // The northern row comes first in the file, row 0 is the southern one
+    std::string esri = "ncols 3\nnrows 2\nxllcorner 100\nyllcorner 200\ncellsize 10\nNODATA_value -9999\n"
+                       "1 2 3\n4 -9999 6\n";
+    check(load_text("esri.asc", esri, map) == 0, "ESRI grid loads");
+    check_map(map, 3, 2, {4, 0, 6, 1, 2, 3}, "ESRI grid");
+    check(map.header.originX == 105.0 && map.header.originY == 205.0, "ESRI origin is the lower left cell centre");
+    check(map.header.spacingX == 10.0 && map.header.spacingY == 10.0, "ESRI spacing");
+    close_height_map(map);
+
+    check(load_text("esri_centre.asc", "ncols 1\nnrows 1\nxllcenter 5\nyllcenter 6\n7\n", map) == 0,
+        "ESRI grid with a centre origin loads");
+    check(map.header.originX == 5.0 && map.header.originY == 6.0, "ESRI centre origin");
+    close_height_map(map);
+
+    check(load_text("unknown.asc", "ncols 1\nnrows 1\ncolour red\n1\n", map) != 0, "unknown ESRI key is rejected");
+    close_height_map(map);
+
+    // No header: the first row sets the width, including leading nan and inf
+    const float nan = std::numeric_limits<float>::quiet_NaN(), inf = std::numeric_limits<float>::infinity();
+    check(load_text("bare.txt", "nan 1 2\n3 inf 5\n\n6 7 8\n", map) == 0, "bare grid starting with nan loads");
+    check_map(map, 3, 3, {nan, 1, 2, 3, inf, 5, 6, 7, 8}, "bare grid");
+    check(map.header.originX == 0.0 && map.header.originY == 0.0, "bare origin");
+    close_height_map(map);
+
+    check(load_text("inf.txt", "inf 1\n2 3\n", map) == 0, "bare grid starting with inf loads");
+    close_height_map(map);
+
+    check(load_text("ragged.txt", "1 2 3\n4 5\n", map) != 0, "ragged bare grid is rejected");
+    close_height_map(map);
+
+    // Points with y ascending keep their order
+    check(load_text("up.xyz", "0 5 3\n5 5 4\n0 10 1\n5 10 2\n", map) == 0, "ascending xyz loads");
+    check_map(map, 2, 2, {3, 4, 1, 2}, "ascending xyz");
+    check(map.header.originX == 0.0 && map.header.originY == 5.0, "ascending xyz origin");
+    check(map.header.spacingX == 5.0 && map.header.spacingY == 5.0, "ascending xyz spacing");
+    close_height_map(map);
+
+    // Descending y is flipped, so row 0 is still the lowest y
+    check(load_text("down.xyz", "0 10 1\n5 10 2\n0 5 3\n5 5 4\n", map) == 0, "descending xyz loads");
+    check_map(map, 2, 2, {3, 4, 1, 2}, "descending xyz");
+    check(map.header.originX == 0.0 && map.header.originY == 5.0, "descending xyz origin");
+    check(map.header.spacingY == 5.0, "descending xyz spacing");
+    close_height_map(map);
+
+    check(load_text("partial.xyz", "0 0 1\n1 0 2\n0 1\n", map) != 0, "xyz with a partial point is rejected");
+    close_height_map(map);
+}
+
+int main() {
+    test_crc32();
+    test_compression();
+    test_height_maps();
+    if (failures == 0) std::cout << "All file format checks passed\n";
+    return failures == 0 ? 0 : 1;
+}
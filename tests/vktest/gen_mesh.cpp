@@ -1,4 +1,5 @@
 #include "gen_mesh.hpp"
+#include "heightMap.hpp"
 
 std::vector<Vertex> generateGridVertices(const std::vector<std::vector<float>>& heightMap, float gridSize, float maxHeight) {
     std::vector<Vertex> vertices;
@@ -48,27 +49,19 @@ std::vector<uint16_t> generateGridIndices(size_t rows, size_t cols) {
 }
 
 std::vector<std::vector<float>> readHeightMap(const std::string& filename) {
-    std::vector<std::vector<float>> heightMap;
-    std::ifstream file(filename);
-
-    if (!file.is_open()) {
+    HeightMap map;
+    if (0 != load_height_map(filename, map)) {
         throw std::runtime_error("Failed to open file: " + filename);
     }
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream lineStream(line);
-        std::vector<float> row;
-        float value;
-
-        while (lineStream >> value) {
-            row.push_back(value);
+    std::vector<std::vector<float>> heightMap(map.header.rows, std::vector<float>(map.header.cols));
+    for (size_t row = 0; row < map.header.rows; ++row) {
+        for (size_t col = 0; col < map.header.cols; ++col) {
+            heightMap[row][col] = height_at(map, col, row);
         }
-
-        heightMap.push_back(row);
     }
 
-    file.close();
+    close_height_map(map);
     return heightMap;
 }
 